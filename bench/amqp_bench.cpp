@@ -0,0 +1,471 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/chrono.hpp>
+#include <boost/ref.hpp>
+#include <amqp_channel.hpp>
+#include <amqp_encoder.hpp>
+#include <amqp_frame_reader.hpp>
+#include <amqp_process.hpp>
+#include <amqp_publish_batch.hpp>
+#include <amqp_publish_template.hpp>
+#include <amqp_visitor.hpp>
+#include "../test/fake_broker.hpp"
+
+// Benchmarks the consume and publish paths against an in-process fake
+// broker on a loopback socket; no external broker is needed.
+//
+// usage: amqp_bench [messages] [min_size] [max_size] [rate]
+//   rate is in messages per second, 0 for unlimited
+
+namespace
+{
+    typedef boost::chrono::steady_clock Clock;
+
+    const size_t template_count = 64;
+    const amqp_channel_t bench_channel = 1;
+
+    inline uint64_t now_ns()
+    {
+        return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                    Clock::now().time_since_epoch()).count();
+    }
+
+    // Log-linear latency histogram: 16 linear sub-buckets per power of two.
+    class Histogram
+    {
+    public:
+        Histogram():
+            counts_(64 * sub_buckets),
+            total_(),
+            max_()
+        {}
+
+        void record(uint64_t value)
+        {
+            ++counts_[index(value)];
+            ++total_;
+            max_ = std::max(max_, value);
+        }
+
+        uint64_t percentile(double p) const
+        {
+            const uint64_t rank = static_cast<uint64_t>(p / 100 * total_);
+            uint64_t seen = 0;
+            for(size_t i = 0; i < counts_.size(); ++i)
+            {
+                seen += counts_[i];
+                if(seen > rank)
+                    return value(i);
+            }
+            return max_;
+        }
+
+        void print(const char* unit) const
+        {
+            printf("    latency %s: p50 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+                   unit,
+                   static_cast<unsigned long long>(percentile(50)),
+                   static_cast<unsigned long long>(percentile(99)),
+                   static_cast<unsigned long long>(percentile(99.9)),
+                   static_cast<unsigned long long>(max_));
+        }
+
+    private:
+        static const unsigned sub_buckets = 16;
+
+        static size_t index(uint64_t value)
+        {
+            if(value < sub_buckets)
+                return value;
+            unsigned log2 = 63 - __builtin_clzll(value);
+            const uint64_t sub = (value >> (log2 - 4)) & (sub_buckets - 1);
+            return (log2 - 3) * sub_buckets + sub;
+        }
+
+        static uint64_t value(size_t index)
+        {
+            if(index < sub_buckets)
+                return index;
+            const unsigned log2 = index / sub_buckets + 3;
+            const uint64_t sub = index % sub_buckets;
+            return (uint64_t(1) << log2) | (sub << (log2 - 4));
+        }
+
+        std::vector<uint64_t> counts_;
+        uint64_t total_;
+        uint64_t max_;
+    };
+
+    struct Options
+    {
+        Options():
+            messages(200000),
+            min_size(16),
+            max_size(1024),
+            rate()
+        {}
+
+        size_t messages;
+        size_t min_size;
+        size_t max_size;
+        size_t rate;
+    };
+
+    void report(const char* name, size_t messages, uint64_t bytes,
+                Clock::duration elapsed, const Histogram& latency)
+    {
+        const double seconds =
+                boost::chrono::duration<double>(elapsed).count();
+        printf("%s\n", name);
+        printf("    %.0f msgs/s  %.1f MB/s\n", messages / seconds,
+               bytes / seconds / (1 << 20));
+        latency.print("ns");
+    }
+
+    // A pre-encoded deliver + header + body sequence; the first eight body
+    // bytes carry the send time for latency measurement.
+    struct EncodedMessage
+    {
+        std::string frames;
+        size_t timestamp_offset;
+        size_t body_size;
+    };
+
+    // Replays pre-encoded deliveries once the client opens its channel;
+    // installed as the fake broker's OpenHandler.
+    class Replay
+    {
+    public:
+        explicit Replay(const Options& options):
+            options_(options)
+        {
+            FrameEncoder encoder;
+            unsigned seed = 12345;
+
+            for(size_t i = 0; i < template_count; ++i)
+            {
+                seed = seed * 1103515245 + 12345;
+                const size_t span = options_.max_size - options_.min_size + 1;
+                const size_t size = std::max<size_t>(
+                            options_.min_size + (seed >> 8) % span, 8);
+
+                amqp_basic_deliver_t deliver;
+                deliver.consumer_tag = amqp_cstring_bytes("bench");
+                deliver.delivery_tag = i + 1;
+                deliver.redelivered = 0;
+                deliver.exchange = amqp_empty_bytes;
+                deliver.routing_key = amqp_cstring_bytes("bench");
+
+                amqp_basic_properties_t props = amqp_basic_properties_t();
+                props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG;
+                props.content_type =
+                        amqp_cstring_bytes("application/octet-stream");
+
+                std::string body(size, 'x');
+                amqp_bytes_t body_bytes;
+                body_bytes.bytes = &body[0];
+                body_bytes.len = body.size();
+
+                encoder.clear();
+                encoder.method(bench_channel, AMQP_BASIC_DELIVER_METHOD,
+                               &deliver);
+                encoder.header(bench_channel, size, props);
+                const size_t body_start = encoder.size();
+                encoder.body(bench_channel, body_bytes);
+
+                EncodedMessage message;
+                message.frames.assign(encoder.data(), encoder.size());
+                message.timestamp_offset =
+                        body_start + FrameEncoder::frame_header_size;
+                message.body_size = size;
+                templates_.push_back(message);
+            }
+        }
+
+        void operator()(FakeBroker& broker, amqp_channel_t)
+        {
+            const size_t chunk = 64;
+            const Clock::time_point start = Clock::now();
+            std::string buffer;
+
+            for(size_t sent = 0; sent < options_.messages; )
+            {
+                buffer.clear();
+                const size_t count = std::min(chunk, options_.messages - sent);
+                const uint64_t timestamp = now_ns();
+
+                for(size_t i = 0; i < count; ++i)
+                {
+                    const EncodedMessage& message =
+                            templates_[(sent + i) % template_count];
+                    const size_t offset = buffer.size();
+                    buffer += message.frames;
+                    memcpy(&buffer[offset + message.timestamp_offset],
+                           &timestamp, sizeof timestamp);
+                }
+
+                broker.send(buffer.data(), buffer.size());
+                sent += count;
+
+                if(options_.rate > 0)
+                {
+                    const Clock::time_point due = start +
+                            boost::chrono::microseconds(
+                                sent * 1000000 / options_.rate);
+                    boost::this_thread::sleep_until(due);
+                }
+            }
+        }
+
+    private:
+        const Options options_;
+        std::vector<EncodedMessage> templates_;
+    };
+
+    void report_broker_errors(FakeBroker& broker)
+    {
+        const std::vector<std::string> errors = broker.errors();
+        for(size_t i = 0; i < errors.size(); ++i)
+            std::cerr << errors[i] << std::endl;
+    }
+
+    uint64_t body_timestamp(const AmqpVisitor& visitor)
+    {
+        uint64_t timestamp = 0;
+        switch(visitor.mode())
+        {
+        case AmqpVisitor::copy_body:
+            memcpy(&timestamp, visitor.body().data(), sizeof timestamp);
+            break;
+
+        case AmqpVisitor::reference_body:
+            memcpy(&timestamp, visitor.body_view().fragment(0).bytes,
+                   sizeof timestamp);
+            break;
+
+        case AmqpVisitor::pooled_body:
+            memcpy(&timestamp, visitor.body_buffer()->data(),
+                   sizeof timestamp);
+            break;
+
+        case AmqpVisitor::streamed_body:
+            // only the sink saw the body
+            break;
+        }
+        return timestamp;
+    }
+
+    void bench_consume(const Options& options, const char* name,
+                       AmqpVisitor& visitor)
+    {
+        Replay replay(options);
+        FakeBroker broker(boost::ref(replay));
+        Histogram latency;
+        uint64_t bytes = 0;
+        Clock::duration elapsed;
+        {
+            AmqpConnection conn("127.0.0.1", broker.port());
+            AmqpChannel channel(conn, bench_channel);
+            AmqpProcessor processor;
+            amqp_frame_t frame;
+
+            const Clock::time_point start = Clock::now();
+            for(size_t i = 0; i < options.messages; ++i)
+            {
+                bool delivered = false;
+                while(!delivered)
+                {
+                    check("Waiting for frame", conn.wait_frame(frame));
+                    AmqpProcessor::Result result =
+                            processor.process_frame(frame);
+                    delivered = boost::apply_visitor(visitor, result);
+                }
+
+                latency.record(now_ns() - body_timestamp(visitor));
+                bytes += visitor.body_size();
+                visitor.reset();
+                conn.release_buffers();
+            }
+            elapsed = Clock::now() - start;
+        }
+        broker.join();
+        report_broker_errors(broker);
+
+        report(name, options.messages, bytes, elapsed, latency);
+    }
+
+    void bench_consume_batched(const Options& options, const char* name,
+                               AmqpVisitor& visitor)
+    {
+        Replay replay(options);
+        FakeBroker broker(boost::ref(replay));
+        Histogram latency;
+        uint64_t bytes = 0;
+        Clock::duration elapsed;
+        {
+            AmqpConnection conn("127.0.0.1", broker.port());
+            AmqpChannel channel(conn, bench_channel);
+            FrameReader reader(conn);
+            AmqpProcessor processor;
+
+            const Clock::time_point start = Clock::now();
+            for(size_t i = 0; i < options.messages; )
+            {
+                // body views point into the reader's ring and stay valid
+                // until the next read
+                const int count = reader.read();
+                check("Reading frames", count);
+
+                for(int j = 0; j < count; ++j)
+                {
+                    AmqpProcessor::Result result =
+                            processor.process_frame(reader[j]);
+                    if(!boost::apply_visitor(visitor, result))
+                        continue;
+
+                    latency.record(now_ns() - body_timestamp(visitor));
+                    bytes += visitor.body_size();
+                    visitor.reset();
+                    ++i;
+                }
+            }
+            elapsed = Clock::now() - start;
+        }
+        broker.join();
+        report_broker_errors(broker);
+
+        report(name, options.messages, bytes, elapsed, latency);
+    }
+
+    enum PublishMode
+    {
+        channel_publish,
+        batch_publish,
+        template_publish
+    };
+
+    const char* publish_name(PublishMode mode)
+    {
+        switch(mode)
+        {
+        case channel_publish:
+            return "publish (AmqpChannel)";
+
+        case batch_publish:
+            return "publish (PublishBatch)";
+
+        case template_publish:
+            return "publish (PublishTemplate + PublishBatch)";
+        }
+        return "";
+    }
+
+    void bench_publish(const Options& options, PublishMode mode)
+    {
+        FakeBroker broker;
+        Histogram latency;
+        uint64_t bytes = 0;
+        Clock::time_point start;
+        {
+            AmqpConnection conn("127.0.0.1", broker.port());
+            AmqpChannel channel(conn, bench_channel);
+            PublishBatch batch(channel);
+
+            PublishData template_data(amqp_cstring_bytes("bench"),
+                                      std::string());
+            PublishTemplate publish_template(channel, template_data);
+            PublishFields fields;
+
+            std::string body(options.max_size, 'x');
+            unsigned seed = 12345;
+            start = Clock::now();
+
+            for(size_t i = 0; i < options.messages; ++i)
+            {
+                seed = seed * 1103515245 + 12345;
+                const size_t span = options.max_size - options.min_size + 1;
+                const size_t size = options.min_size + (seed >> 8) % span;
+
+                const uint64_t before = now_ns();
+                if(mode == template_publish)
+                {
+                    amqp_bytes_t bytes_view;
+                    bytes_view.bytes = &body[0];
+                    bytes_view.len = size;
+                    fields.timestamp = i;
+                    batch.add(publish_template, bytes_view, fields);
+                }
+                else
+                {
+                    PublishData data(amqp_cstring_bytes("bench"),
+                                     body.substr(0, size));
+                    if(mode == batch_publish)
+                        batch.add(data);
+                    else
+                        channel.publish(data);
+                }
+                latency.record(now_ns() - before);
+                bytes += size;
+            }
+            batch.flush();
+        }
+        broker.join();
+        report_broker_errors(broker);
+
+        report(publish_name(mode), options.messages, bytes,
+               Clock::now() - start, latency);
+        printf("    broker received %llu bytes\n",
+               static_cast<unsigned long long>(broker.received_bytes()));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if(argc > 1)
+        options.messages = strtoul(argv[1], 0, 10);
+    if(argc > 2)
+        options.min_size = strtoul(argv[2], 0, 10);
+    if(argc > 3)
+        options.max_size = strtoul(argv[3], 0, 10);
+    if(argc > 4)
+        options.rate = strtoul(argv[4], 0, 10);
+
+    if(options.max_size < options.min_size)
+    {
+        std::cerr << "max_size must not be less than min_size" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        AmqpVisitor copy_visitor;
+        bench_consume(options, "consume (copy_body)", copy_visitor);
+
+        AmqpVisitor reference_visitor(AmqpVisitor::reference_body);
+        bench_consume(options, "consume (reference_body)", reference_visitor);
+
+        BodyBufferPool pool;
+        AmqpVisitor pooled_visitor(pool);
+        bench_consume(options, "consume (pooled_body)", pooled_visitor);
+
+        AmqpVisitor batched_visitor(AmqpVisitor::reference_body);
+        bench_consume_batched(options, "consume (FrameReader, reference_body)",
+                              batched_visitor);
+
+        bench_publish(options, channel_publish);
+        bench_publish(options, batch_publish);
+        bench_publish(options, template_publish);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
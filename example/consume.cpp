@@ -22,7 +22,7 @@ int main(int argc, char* argv[])
         channel.consume(consume_data);
 
         AmqpProcessor amqp_processor;
-        AmqpVisitor visitor;
+        AmqpVisitor visitor(AmqpVisitor::reference_body);
 
         amqp_frame_t frame;
 
@@ -43,13 +43,18 @@ int main(int argc, char* argv[])
 
             const amqp_basic_properties_t* properties = visitor.properties();
             uint64_t delivery_tag = visitor.delivery_tag();
-            std::string body = visitor.body();
+            const BodyView& body = visitor.body_view();
 
             int correlation_id =  from_amqp_bytes<int>(properties->correlation_id);
             std::cout << "correlation id: " << correlation_id << std::endl;
             std::cout << "delivery_tag: " << delivery_tag << std::endl;
-            std::cout << "body: " << body << std::endl;
+            std::cout << "body: ";
+            for(BodyView::const_iterator it = body.begin(); it != body.end(); ++it)
+                std::cout.write(static_cast<const char*>(it->bytes), it->len);
+            std::cout << std::endl;
+
             visitor.reset();
+            conn.release_buffers();
         }
     }
     catch(const std::exception& e)
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <amqp_coro.hpp>
+
+#ifdef AMQP_HAS_COROUTINES
+
+namespace
+{
+    void ignore_frame(const amqp_frame_t&)
+    {}
+
+    std::exception_ptr failure;
+
+    void stop_on_error(AmqpEventLoop& loop, std::exception_ptr error)
+    {
+        failure = error;
+        loop.stop();
+    }
+
+    Task<void> consume(AsyncChannel& channel, std::string queue)
+    {
+        amqp_bytes_t queue_name = to_amqp_bytes(queue);
+        QueueDeclareResult declared =
+                co_await channel.queue_declare(QueueData(queue_name));
+        std::cout << "queue: " << declared.queue << std::endl;
+
+        ConsumeData consume_data(queue_name);
+        consume_data.no_ack = 0;
+        co_await channel.qos(QosData(100));
+        co_await channel.consume(consume_data);
+
+        while(true)
+        {
+            AsyncMessagePtr message = co_await channel.next_message();
+            std::cout << "delivery_tag: " << message->delivery_tag << std::endl;
+            std::cout << "body: ";
+            std::cout.write(message->body->data(), message->body->size());
+            std::cout << std::endl;
+            channel.ack(message->delivery_tag);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3)
+    {
+        std::cerr << "usage: consume_coro <server> <queue>" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        AmqpConnection conn(argv[1]);
+        AmqpChannel channel(conn);
+        BodyBufferPool pool;
+
+        AmqpEventLoop loop;
+        loop.add(conn, ignore_frame);
+        AsyncChannel async_channel(loop, channel, pool);
+
+        spawn(consume(async_channel, argv[2]),
+              [&loop](std::exception_ptr error) {
+                  stop_on_error(loop, error);
+              });
+        loop.run();
+        if(failure)
+            std::rethrow_exception(failure);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+#else
+
+int main()
+{
+    std::cerr << "consume_coro needs a compiler with C++20 coroutines"
+              << std::endl;
+    return 1;
+}
+
+#endif // AMQP_HAS_COROUTINES
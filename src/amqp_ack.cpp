@@ -0,0 +1,152 @@
+#include "amqp_ack.hpp"
+
+AckAccumulator::AckAccumulator(AmqpChannel& channel, size_t max_batch,
+                               Clock::duration max_delay, uint64_t first_tag):
+    channel_(channel),
+    max_batch_(max_batch),
+    max_delay_(max_delay),
+    base_tag_(first_tag),
+    contiguous_upto_(first_tag - 1),
+    sent_upto_(first_tag - 1),
+    frames_(channel.connection().frame_max()),
+    queued_()
+{
+    frames_.metrics(channel.connection().metrics());
+}
+
+void AckAccumulator::complete(uint64_t delivery_tag)
+{
+    mark(delivery_tag, false);
+    if(pending() + queued_ >= max_batch_)
+        flush();
+}
+
+void AckAccumulator::reject(uint64_t delivery_tag, bool requeue)
+{
+    flush();
+    channel_.reject(delivery_tag, requeue);
+    mark(delivery_tag, true);
+}
+
+void AckAccumulator::nack(uint64_t delivery_tag, bool requeue)
+{
+    flush();
+    channel_.nack(delivery_tag, false, requeue);
+    mark(delivery_tag, true);
+}
+
+void AckAccumulator::defer_reject(uint64_t delivery_tag, bool requeue)
+{
+    if(idle())
+        oldest_pending_ = Clock::now();
+
+    amqp_basic_reject_t method;
+    method.delivery_tag = delivery_tag;
+    method.requeue = requeue;
+    frames_.method(channel_.id(), AMQP_BASIC_REJECT_METHOD, &method);
+    ++queued_;
+
+    mark(delivery_tag, true);
+}
+
+void AckAccumulator::mark(uint64_t delivery_tag, bool rejected)
+{
+    if(delivery_tag <= contiguous_upto_)
+        return;
+
+    const uint64_t offset = delivery_tag - base_tag_;
+    const size_t word = offset / word_bits;
+    if(word >= words_.size())
+    {
+        words_.resize(word + 1);
+        rejected_.resize(word + 1);
+    }
+
+    const uint64_t bit = uint64_t(1) << (offset % word_bits);
+    words_[word] |= bit;
+    if(rejected)
+        rejected_[word] |= bit;
+
+    if(delivery_tag == contiguous_upto_ + 1)
+        advance();
+}
+
+void AckAccumulator::advance()
+{
+    bool was_idle = idle();
+
+    while(!words_.empty())
+    {
+        const uint64_t offset = contiguous_upto_ + 1 - base_tag_;
+        const uint64_t bit = uint64_t(1) << offset;
+
+        if((words_.front() & bit) == 0)
+            break;
+
+        if(rejected_.front() & bit)
+        {
+            // the rejected tag is settled already; end the range below it
+            // and restart after it
+            queue_ack();
+            sent_upto_ = contiguous_upto_ + 1;
+        }
+
+        ++contiguous_upto_;
+        if(offset + 1 == word_bits)
+        {
+            words_.pop_front();
+            rejected_.pop_front();
+            base_tag_ += word_bits;
+        }
+    }
+
+    if(was_idle && !idle())
+        oldest_pending_ = Clock::now();
+}
+
+void AckAccumulator::poll()
+{
+    if(!idle() && Clock::now() - oldest_pending_ >= max_delay_)
+        flush();
+}
+
+void AckAccumulator::flush()
+{
+    send(false);
+}
+
+void AckAccumulator::queue_ack()
+{
+    const size_t count = pending();
+    if(count == 0)
+        return;
+
+    amqp_basic_ack_t method;
+    method.delivery_tag = contiguous_upto_;
+    method.multiple = count > 1;
+    frames_.method(channel_.id(), AMQP_BASIC_ACK_METHOD, &method);
+    ++queued_;
+    sent_upto_ = contiguous_upto_;
+}
+
+void AckAccumulator::send(bool nothrow)
+{
+    queue_ack();
+    if(queued_ == 0)
+        return;
+
+    queued_ = 0;
+    const int rc = frames_.send(channel_.connection());
+    check("Ack", rc, nothrow);
+
+    if(ConnectionMetrics* metrics = channel_.connection().metrics())
+    {
+        if(ChannelMetrics* channel_metrics = metrics->channel(channel_.id()))
+            channel_metrics->acked(sent_upto_);
+    }
+}
+
+AckAccumulator::~AckAccumulator()
+{
+    send(true);
+}
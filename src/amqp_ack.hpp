@@ -0,0 +1,94 @@
+#ifndef AMQP_ACK_HPP
+#define AMQP_ACK_HPP
+
+#include <deque>
+#include <boost/chrono.hpp>
+#include "amqp_channel.hpp"
+#include "amqp_encoder.hpp"
+
+// Coalesces consumer acknowledgements into multiple=true basic.ack frames.
+// Completions may arrive in any order; they are recorded in a bitmap and
+// only the highest contiguous delivery tag is acknowledged. A flush happens
+// once max_batch contiguous completions are pending or, from poll(), once
+// the oldest pending completion is older than max_delay.
+//
+// A rejected or nacked tag ends an ack range: no ack ever names or covers
+// it, since the broker closes the channel on an ack for a tag it no longer
+// knows, and no ack above it is sent before the reject.
+class AckAccumulator: boost::noncopyable
+{
+public:
+    typedef boost::chrono::steady_clock Clock;
+
+    explicit AckAccumulator(AmqpChannel& channel, size_t max_batch = 64,
+                            Clock::duration max_delay =
+                                boost::chrono::milliseconds(100),
+                            uint64_t first_tag = 1);
+
+    void complete(uint64_t delivery_tag);
+
+    // Sends basic.reject or basic.nack immediately, after flushing the
+    // pending acks; the tag then no longer holds back later acks.
+    void reject(uint64_t delivery_tag, bool requeue = true);
+    void nack(uint64_t delivery_tag, bool requeue = true);
+
+    // Queues basic.reject for the next flush instead of sending it; queued
+    // rejects go out in one write, ahead of the acks sent with them, so
+    // no multiple ack reaches the broker before a reject below it.
+    void defer_reject(uint64_t delivery_tag, bool requeue = true);
+
+    // Flushes if the oldest pending completion or queued reject is due.
+    void poll();
+    void flush();
+
+    const AmqpChannel& channel() const
+    {
+        return channel_;
+    }
+
+    uint64_t acked_upto() const
+    {
+        return sent_upto_;
+    }
+
+    size_t pending() const
+    {
+        return contiguous_upto_ - sent_upto_;
+    }
+
+
+    ~AckAccumulator();
+
+private:
+    static const unsigned word_bits = 64;
+
+    bool idle() const
+    {
+        return pending() == 0 && queued_ == 0;
+    }
+
+    void mark(uint64_t delivery_tag, bool rejected);
+    void advance();
+    void queue_ack();
+    void send(bool nothrow);
+
+    AmqpChannel& channel_;
+    const size_t max_batch_;
+    const Clock::duration max_delay_;
+
+    // bit i of words_[w] stands for tag base_tag_ + w * word_bits + i;
+    // rejected_ has the same layout and marks tags settled without an ack
+    std::deque<uint64_t> words_;
+    std::deque<uint64_t> rejected_;
+    uint64_t base_tag_;
+    uint64_t contiguous_upto_;
+    uint64_t sent_upto_;
+    Clock::time_point oldest_pending_;
+
+    // deferred rejects and the acks of ranges ended by a reject, in the
+    // order they must reach the broker
+    FrameEncoder frames_;
+    size_t queued_;
+};
+
+#endif // AMQP_ACK_HPP
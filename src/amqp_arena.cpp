@@ -0,0 +1,339 @@
+#include "amqp_arena.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace
+{
+    const size_t min_block_size = 256;
+
+    inline size_t aligned(size_t size)
+    {
+        return (size + 7) & ~size_t(7);
+    }
+
+    template<typename T> inline T* allocate(AmqpArena& arena, size_t count)
+    {
+        return static_cast<T*>(arena.allocate(count * sizeof(T)));
+    }
+
+    const amqp_flags_t bytes_flags[] =
+    {
+        AMQP_BASIC_CONTENT_TYPE_FLAG,
+        AMQP_BASIC_CONTENT_ENCODING_FLAG,
+        AMQP_BASIC_CORRELATION_ID_FLAG,
+        AMQP_BASIC_REPLY_TO_FLAG,
+        AMQP_BASIC_EXPIRATION_FLAG,
+        AMQP_BASIC_MESSAGE_ID_FLAG,
+        AMQP_BASIC_TYPE_FLAG,
+        AMQP_BASIC_USER_ID_FLAG,
+        AMQP_BASIC_APP_ID_FLAG,
+        AMQP_BASIC_CLUSTER_ID_FLAG
+    };
+
+    const size_t bytes_field_count = sizeof bytes_flags / sizeof bytes_flags[0];
+
+    // the bytes members of amqp_basic_properties_t, in bytes_flags order
+    inline amqp_bytes_t& bytes_field(amqp_basic_properties_t& props, size_t i)
+    {
+        amqp_bytes_t* const fields[] =
+        {
+            &props.content_type,
+            &props.content_encoding,
+            &props.correlation_id,
+            &props.reply_to,
+            &props.expiration,
+            &props.message_id,
+            &props.type,
+            &props.user_id,
+            &props.app_id,
+            &props.cluster_id
+        };
+        return *fields[i];
+    }
+
+    inline const amqp_bytes_t& bytes_field(const amqp_basic_properties_t& props,
+                                           size_t i)
+    {
+        return bytes_field(const_cast<amqp_basic_properties_t&>(props), i);
+    }
+}
+
+AmqpArena::AmqpArena(size_t block_size):
+    block_size_(block_size),
+    next_(),
+    left_()
+{}
+
+AmqpArena::~AmqpArena()
+{
+    for(size_t i = 0; i < blocks_.size(); ++i)
+        free(blocks_[i].first);
+}
+
+void AmqpArena::add_block(size_t size)
+{
+    size = std::max(size, block_size_);
+    char* block = static_cast<char*>(malloc(size));
+    if(block == 0)
+        throw std::bad_alloc();
+
+    blocks_.push_back(std::make_pair(block, size));
+    next_ = block;
+    left_ = size;
+}
+
+void* AmqpArena::allocate(size_t size)
+{
+    size = aligned(size);
+    if(size > left_)
+        add_block(size);
+
+    void* result = next_;
+    next_ += size;
+    left_ -= size;
+    return result;
+}
+
+void AmqpArena::reserve(size_t size)
+{
+    if(size > left_)
+        add_block(size);
+}
+
+void AmqpArena::reset()
+{
+    if(blocks_.empty())
+        return;
+
+    size_t largest = 0;
+    for(size_t i = 1; i < blocks_.size(); ++i)
+    {
+        if(blocks_[i].second > blocks_[largest].second)
+            largest = i;
+    }
+
+    const std::pair<char*, size_t> kept = blocks_[largest];
+    for(size_t i = 0; i < blocks_.size(); ++i)
+    {
+        if(i != largest)
+            free(blocks_[i].first);
+    }
+
+    blocks_.assign(1, kept);
+    next_ = kept.first;
+    left_ = kept.second;
+}
+
+amqp_bytes_t AmqpArena::copy(const amqp_bytes_t& bytes)
+{
+    amqp_bytes_t result;
+    result.len = bytes.len;
+    result.bytes = 0;
+    if(bytes.len > 0)
+    {
+        result.bytes = allocate(bytes.len);
+        memcpy(result.bytes, bytes.bytes, bytes.len);
+    }
+    return result;
+}
+
+amqp_field_value_t AmqpArena::copy(const amqp_field_value_t& value)
+{
+    amqp_field_value_t result = value;
+    switch(value.kind)
+    {
+    case AMQP_FIELD_KIND_UTF8:
+    case AMQP_FIELD_KIND_BYTES:
+        result.value.bytes = copy(value.value.bytes);
+        break;
+
+    case AMQP_FIELD_KIND_ARRAY:
+        result.value.array = copy(value.value.array);
+        break;
+
+    case AMQP_FIELD_KIND_TABLE:
+        result.value.table = copy(value.value.table);
+        break;
+
+    default:
+        break;
+    }
+    return result;
+}
+
+amqp_table_t AmqpArena::copy(const amqp_table_t& table)
+{
+    amqp_table_t result;
+    result.num_entries = table.num_entries;
+    result.entries = 0;
+    if(table.num_entries > 0)
+    {
+        result.entries = ::allocate<amqp_table_entry_t>(*this,
+                                                        table.num_entries);
+        for(int i = 0; i < table.num_entries; ++i)
+        {
+            result.entries[i].key = copy(table.entries[i].key);
+            result.entries[i].value = copy(table.entries[i].value);
+        }
+    }
+    return result;
+}
+
+amqp_array_t AmqpArena::copy(const amqp_array_t& array)
+{
+    amqp_array_t result;
+    result.num_entries = array.num_entries;
+    result.entries = 0;
+    if(array.num_entries > 0)
+    {
+        result.entries = ::allocate<amqp_field_value_t>(*this,
+                                                        array.num_entries);
+        for(int i = 0; i < array.num_entries; ++i)
+            result.entries[i] = copy(array.entries[i]);
+    }
+    return result;
+}
+
+amqp_basic_properties_t AmqpArena::copy(const amqp_basic_properties_t& props)
+{
+    amqp_basic_properties_t result = props;
+    for(size_t i = 0; i < bytes_field_count; ++i)
+    {
+        if(props._flags & bytes_flags[i])
+            bytes_field(result, i) = copy(bytes_field(props, i));
+    }
+
+    if(props._flags & AMQP_BASIC_HEADERS_FLAG)
+        result.headers = copy(props.headers);
+    return result;
+}
+
+size_t AmqpArena::required(const amqp_bytes_t& bytes)
+{
+    return aligned(bytes.len);
+}
+
+size_t AmqpArena::required(const amqp_field_value_t& value)
+{
+    switch(value.kind)
+    {
+    case AMQP_FIELD_KIND_UTF8:
+    case AMQP_FIELD_KIND_BYTES:
+        return required(value.value.bytes);
+
+    case AMQP_FIELD_KIND_ARRAY:
+        return required(value.value.array);
+
+    case AMQP_FIELD_KIND_TABLE:
+        return required(value.value.table);
+
+    default:
+        return 0;
+    }
+}
+
+size_t AmqpArena::required(const amqp_table_t& table)
+{
+    size_t size = aligned(table.num_entries * sizeof(amqp_table_entry_t));
+    for(int i = 0; i < table.num_entries; ++i)
+    {
+        size += required(table.entries[i].key);
+        size += required(table.entries[i].value);
+    }
+    return size;
+}
+
+size_t AmqpArena::required(const amqp_array_t& array)
+{
+    size_t size = aligned(array.num_entries * sizeof(amqp_field_value_t));
+    for(int i = 0; i < array.num_entries; ++i)
+        size += required(array.entries[i]);
+    return size;
+}
+
+size_t AmqpArena::required(const amqp_basic_properties_t& props)
+{
+    size_t size = 0;
+    for(size_t i = 0; i < bytes_field_count; ++i)
+    {
+        if(props._flags & bytes_flags[i])
+            size += required(bytes_field(props, i));
+    }
+
+    if(props._flags & AMQP_BASIC_HEADERS_FLAG)
+        size += required(props.headers);
+    return size;
+}
+
+AmqpArenaTable::AmqpArenaTable(size_t block_size):
+    arena_(block_size)
+{}
+
+AmqpArenaTable::AmqpArenaTable(const amqp_table_t& table):
+    arena_(std::max(AmqpArena::required(table), min_block_size))
+{
+    assign(table);
+}
+
+void AmqpArenaTable::add(const amqp_bytes_t& key,
+                         const amqp_field_value_t& value)
+{
+    amqp_table_entry_t entry;
+    entry.key = arena_.copy(key);
+    entry.value = arena_.copy(value);
+    entries_.push_back(entry);
+}
+
+void AmqpArenaTable::assign(const amqp_table_t& table)
+{
+    clear();
+    entries_.reserve(table.num_entries);
+
+    size_t size = 0;
+    for(int i = 0; i < table.num_entries; ++i)
+    {
+        size += AmqpArena::required(table.entries[i].key);
+        size += AmqpArena::required(table.entries[i].value);
+    }
+    arena_.reserve(size);
+
+    for(int i = 0; i < table.num_entries; ++i)
+        add(table.entries[i].key, table.entries[i].value);
+}
+
+void AmqpArenaTable::clear()
+{
+    entries_.clear();
+    arena_.reset();
+}
+
+amqp_table_t AmqpArenaTable::data() const
+{
+    amqp_table_t table;
+    table.num_entries = entries_.size();
+    table.entries = entries_.empty() ? 0 :
+            const_cast<amqp_table_entry_t*>(&entries_[0]);
+    return table;
+}
+
+AmqpArenaProperties::AmqpArenaProperties():
+    properties_()
+{}
+
+AmqpArenaProperties::AmqpArenaProperties(const amqp_basic_properties_t* props):
+    arena_(props != 0 ?
+               std::max(AmqpArena::required(*props), min_block_size) : 4096),
+    properties_()
+{
+    if(props != 0)
+        assign(*props);
+}
+
+void AmqpArenaProperties::assign(const amqp_basic_properties_t& props)
+{
+    arena_.reset();
+    arena_.reserve(AmqpArena::required(props));
+    properties_ = arena_.copy(props);
+}
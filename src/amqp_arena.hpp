@@ -0,0 +1,104 @@
+#ifndef AMQP_ARENA_HPP
+#define AMQP_ARENA_HPP
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <amqp.h>
+#include "util.hpp"
+
+// Monotonic bump allocator for AMQP field data. Everything allocated from
+// it is released at once by reset() or by the destructor. reset() keeps the
+// largest block, so an arena reused for similar data stops allocating.
+class AmqpArena: boost::noncopyable
+{
+public:
+    explicit AmqpArena(size_t block_size = 4096);
+
+    void* allocate(size_t size);
+
+    // Makes sure the next size bytes of allocations need no new block.
+    void reserve(size_t size);
+    void reset();
+
+    amqp_bytes_t copy(const amqp_bytes_t& bytes);
+    amqp_field_value_t copy(const amqp_field_value_t& value);
+    amqp_table_t copy(const amqp_table_t& table);
+    amqp_array_t copy(const amqp_array_t& array);
+    amqp_basic_properties_t copy(const amqp_basic_properties_t& props);
+
+    // Arena space a deep copy of the value needs.
+    static size_t required(const amqp_bytes_t& bytes);
+    static size_t required(const amqp_field_value_t& value);
+    static size_t required(const amqp_table_t& table);
+    static size_t required(const amqp_array_t& array);
+    static size_t required(const amqp_basic_properties_t& props);
+
+    ~AmqpArena();
+
+private:
+    void add_block(size_t size);
+
+    const size_t block_size_;
+    std::vector<std::pair<char*, size_t> > blocks_;
+    char* next_;
+    size_t left_;
+};
+
+// Header table built in an arena: keys and values, nested tables and
+// arrays included, are copied into one arena; only the entry array lives
+// separately. Copying a decoded table sizes the arena up front, so the
+// whole copy costs one arena block plus the entry array.
+class AmqpArenaTable: boost::noncopyable
+{
+public:
+    explicit AmqpArenaTable(size_t block_size = 4096);
+    explicit AmqpArenaTable(const amqp_table_t& table);
+
+    void add(const amqp_bytes_t& key, const amqp_field_value_t& value);
+
+    template<typename K, typename V> void add(const K& key, const V& value)
+    {
+        add(to_amqp_bytes(key), to_field_value(value));
+    }
+
+    void assign(const amqp_table_t& table);
+    void clear();
+
+    amqp_table_t data() const;
+
+    operator amqp_table_t() const
+    {
+        return data();
+    }
+
+private:
+    AmqpArena arena_;
+    std::vector<amqp_table_entry_t> entries_;
+};
+
+// Deep copy of decoded message properties, headers included, held in a
+// single arena block. assign() reuses the block for the next message.
+class AmqpArenaProperties: boost::noncopyable
+{
+public:
+    AmqpArenaProperties();
+    explicit AmqpArenaProperties(const amqp_basic_properties_t* props);
+
+    void assign(const amqp_basic_properties_t& props);
+
+    const amqp_basic_properties_t& data() const
+    {
+        return properties_;
+    }
+
+    operator const amqp_basic_properties_t&() const
+    {
+        return properties_;
+    }
+
+private:
+    AmqpArena arena_;
+    amqp_basic_properties_t properties_;
+};
+
+#endif // AMQP_ARENA_HPP
@@ -0,0 +1,119 @@
+#include "amqp_body_pool.hpp"
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace
+{
+    const size_t class_count = 17; // 1 KiB .. 64 MiB
+
+    inline size_t size_class(size_t size)
+    {
+        size_t cls = 0;
+        size_t capacity = BodyBufferPool::min_class_size;
+        while(capacity < size)
+        {
+            capacity <<= 1;
+            ++cls;
+        }
+        return cls;
+    }
+
+    inline size_t class_capacity(size_t cls)
+    {
+        return BodyBufferPool::min_class_size << cls;
+    }
+}
+
+void BodyBuffer::append(const amqp_bytes_t& fragment)
+{
+    if(fragment.len > capacity_ - size_)
+        throw std::runtime_error("Buffering body: more data than body_size");
+    memcpy(data() + size_, fragment.bytes, fragment.len);
+    size_ += fragment.len;
+}
+
+char* BodyBuffer::extend(size_t size)
+{
+    if(size > capacity_ - size_)
+        throw std::runtime_error("Buffering body: more data than body_size");
+    char* out = data() + size_;
+    size_ += size;
+    return out;
+}
+
+void intrusive_ptr_add_ref(BodyBuffer* buffer)
+{
+    buffer->refs_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(BodyBuffer* buffer)
+{
+    if(buffer->refs_.fetch_sub(1, boost::memory_order_release) == 1)
+    {
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        buffer->pool_->recycle(buffer);
+    }
+}
+
+BodyBufferPool::BodyBufferPool(size_t max_cached_per_class):
+    max_cached_(max_cached_per_class),
+    free_(class_count)
+{}
+
+BodyBufferPtr BodyBufferPool::acquire(size_t size)
+{
+    size_t cls = npos;
+    size_t capacity = size;
+
+    if(size <= max_class_size)
+    {
+        cls = size_class(size);
+        capacity = class_capacity(cls);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        std::vector<BodyBuffer*>& list = free_[cls];
+        if(!list.empty())
+        {
+            BodyBuffer* buffer = list.back();
+            list.pop_back();
+            return BodyBufferPtr(buffer);
+        }
+    }
+
+    void* memory = ::operator new(sizeof(BodyBuffer) + capacity);
+    return BodyBufferPtr(new(memory) BodyBuffer(this, capacity, cls));
+}
+
+void BodyBufferPool::recycle(BodyBuffer* buffer)
+{
+    if(buffer->size_class_ != npos)
+    {
+        buffer->clear();
+
+        boost::mutex::scoped_lock lock(mutex_);
+        std::vector<BodyBuffer*>& list = free_[buffer->size_class_];
+        if(list.size() < max_cached_)
+        {
+            list.push_back(buffer);
+            return;
+        }
+    }
+    destroy(buffer);
+}
+
+void BodyBufferPool::destroy(BodyBuffer* buffer)
+{
+    buffer->~BodyBuffer();
+    ::operator delete(buffer);
+}
+
+BodyBufferPool::~BodyBufferPool()
+{
+    for(size_t i = 0; i < free_.size(); ++i)
+    {
+        std::vector<BodyBuffer*>& list = free_[i];
+        for(size_t j = 0; j < list.size(); ++j)
+            destroy(list[j]);
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef AMQP_BODY_POOL_HPP
+#define AMQP_BODY_POOL_HPP
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <amqp.h>
+
+class BodyBufferPool;
+
+// Message body storage handed out by BodyBufferPool. The data area follows
+// the object in the same allocation; the buffer goes back to its pool when
+// the last BodyBufferPtr referencing it is dropped.
+class BodyBuffer: boost::noncopyable
+{
+public:
+    char* data()
+    {
+        return reinterpret_cast<char*>(this + 1);
+    }
+
+    const char* data() const
+    {
+        return reinterpret_cast<const char*>(this + 1);
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    amqp_bytes_t bytes() const
+    {
+        amqp_bytes_t result;
+        result.bytes = const_cast<char*>(data());
+        result.len = size_;
+        return result;
+    }
+
+    // Both throw std::runtime_error rather than grow past capacity().
+    void append(const amqp_bytes_t& fragment);
+
+    // Appends size bytes for the caller to fill in, e.g. by a decoder.
+    char* extend(size_t size);
+
+    void clear()
+    {
+        size_ = 0;
+    }
+
+private:
+    friend class BodyBufferPool;
+    friend void intrusive_ptr_add_ref(BodyBuffer*);
+    friend void intrusive_ptr_release(BodyBuffer*);
+
+    BodyBuffer(BodyBufferPool* pool, size_t capacity, size_t size_class):
+        pool_(pool),
+        capacity_(capacity),
+        size_class_(size_class),
+        size_(),
+        refs_(0)
+    {}
+
+    BodyBufferPool* const pool_;
+    const size_t capacity_;
+    const size_t size_class_;
+    size_t size_;
+    boost::atomic<int> refs_;
+};
+
+typedef boost::intrusive_ptr<BodyBuffer> BodyBufferPtr;
+
+void intrusive_ptr_add_ref(BodyBuffer* buffer);
+void intrusive_ptr_release(BodyBuffer* buffer);
+
+// Power-of-two size classes from min_class_size up to max_class_size.
+// Larger bodies are allocated exactly and freed on release. The pool must
+// outlive every buffer it hands out.
+class BodyBufferPool: boost::noncopyable
+{
+public:
+    static const size_t min_class_size = 1 << 10;
+    static const size_t max_class_size = 1 << 26;
+
+    explicit BodyBufferPool(size_t max_cached_per_class = 64);
+
+    BodyBufferPtr acquire(size_t size);
+
+    ~BodyBufferPool();
+
+private:
+    friend void intrusive_ptr_release(BodyBuffer*);
+
+    static const size_t npos = static_cast<size_t>(-1);
+
+    void recycle(BodyBuffer* buffer);
+    static void destroy(BodyBuffer* buffer);
+
+    const size_t max_cached_;
+    boost::mutex mutex_;
+    std::vector<std::vector<BodyBuffer*> > free_;
+};
+
+#endif // AMQP_BODY_POOL_HPP
@@ -0,0 +1,143 @@
+#include "amqp_body_sink.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "error.hpp"
+
+namespace
+{
+    void write_full(int fd, const char* data, size_t size)
+    {
+        while(size > 0)
+        {
+            const ssize_t rc = ::write(fd, data, size);
+            if(rc < 0 && errno == EINTR)
+                continue;
+            check_os("Writing body", rc);
+            data += rc;
+            size -= rc;
+        }
+    }
+
+    inline int open_output(const std::string& path)
+    {
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        check_os("Opening body file", fd);
+        return fd;
+    }
+}
+
+FileSink::FileSink(const SinkPathMaker& path_maker):
+    path_maker_(path_maker),
+    fd_(-1)
+{}
+
+FileSink::~FileSink()
+{
+    close_file(true);
+}
+
+void FileSink::close_file(bool nothrow)
+{
+    if(fd_ < 0)
+        return;
+
+    const int rc = close(fd_);
+    fd_ = -1;
+    check_os("Closing body file", rc, nothrow);
+}
+
+void FileSink::begin(uint64_t delivery_tag,
+                     const amqp_basic_properties_t* properties, uint64_t)
+{
+    close_file(false);
+    path_ = path_maker_(delivery_tag, properties);
+    fd_ = open_output(path_);
+}
+
+void FileSink::write(const amqp_bytes_t& fragment)
+{
+    write_full(fd_, static_cast<const char*>(fragment.bytes), fragment.len);
+}
+
+void FileSink::end()
+{
+    close_file(false);
+}
+
+MappedSink::MappedSink(const SinkPathMaker& path_maker):
+    path_maker_(path_maker),
+    data_(),
+    size_(),
+    written_()
+{}
+
+MappedSink::~MappedSink()
+{
+    unmap(true);
+}
+
+void MappedSink::unmap(bool nothrow)
+{
+    if(data_ == 0)
+        return;
+
+    const int rc = munmap(data_, size_);
+    data_ = 0;
+    size_ = 0;
+    check_os("Unmapping body", rc, nothrow);
+}
+
+void MappedSink::begin(uint64_t delivery_tag,
+                       const amqp_basic_properties_t* properties,
+                       uint64_t body_size)
+{
+    unmap(false);
+    written_ = 0;
+    path_.clear();
+
+    // mmap rejects empty mappings; an empty body leaves data() null
+    if(body_size == 0)
+        return;
+
+    int fd = -1;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if(path_maker_)
+    {
+        path_ = path_maker_(delivery_tag, properties);
+        fd = open_output(path_);
+        flags = MAP_SHARED;
+
+        if(ftruncate(fd, body_size) < 0)
+        {
+            const int error = errno;
+            close(fd);
+            errno = error;
+            check_os("Sizing body file", -1);
+        }
+    }
+
+    void* data = mmap(0, body_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(fd >= 0)
+        close(fd);
+    if(data == MAP_FAILED)
+        check_os("Mapping body", -1);
+
+    data_ = static_cast<char*>(data);
+    size_ = body_size;
+}
+
+void MappedSink::write(const amqp_bytes_t& fragment)
+{
+    if(written_ + fragment.len > size_)
+        throw std::runtime_error("Mapping body: more data than body_size");
+
+    memcpy(data_ + written_, fragment.bytes, fragment.len);
+    written_ += fragment.len;
+}
+
+void MappedSink::end()
+{}
@@ -0,0 +1,144 @@
+#ifndef AMQP_BODY_SINK_HPP
+#define AMQP_BODY_SINK_HPP
+
+#include <string>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <amqp.h>
+
+// Receives a message body as it arrives instead of after the last frame.
+// begin() is called with the content header, write() once per body frame
+// with a span that is only valid during the call, end() after the last
+// fragment (right after begin() for an empty body).
+class BodySink: boost::noncopyable
+{
+public:
+    virtual void begin(uint64_t delivery_tag,
+                       const amqp_basic_properties_t* properties,
+                       uint64_t body_size) = 0;
+    virtual void write(const amqp_bytes_t& fragment) = 0;
+    virtual void end() = 0;
+
+    virtual ~BodySink()
+    {}
+};
+
+typedef boost::function<std::string (uint64_t delivery_tag,
+                                     const amqp_basic_properties_t*)>
+    SinkPathMaker;
+
+// Writes every body to its own file, named by path_maker; the file is
+// closed at end().
+class FileSink: public BodySink
+{
+public:
+    explicit FileSink(const SinkPathMaker& path_maker);
+
+    const std::string& path() const
+    {
+        return path_;
+    }
+
+    void begin(uint64_t delivery_tag,
+               const amqp_basic_properties_t* properties,
+               uint64_t body_size);
+    void write(const amqp_bytes_t& fragment);
+    void end();
+
+    ~FileSink();
+
+private:
+    void close_file(bool nothrow);
+
+    const SinkPathMaker path_maker_;
+    std::string path_;
+    int fd_;
+};
+
+// Sizes a file to body_size at begin(), maps it and copies fragments into
+// the mapping. The region stays mapped after end() so the handler can use
+// data() in place, until the next begin() or destruction. An empty
+// path_maker maps anonymous memory instead of a file.
+class MappedSink: public BodySink
+{
+public:
+    explicit MappedSink(const SinkPathMaker& path_maker = SinkPathMaker());
+
+    const char* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    const std::string& path() const
+    {
+        return path_;
+    }
+
+    void begin(uint64_t delivery_tag,
+               const amqp_basic_properties_t* properties,
+               uint64_t body_size);
+    void write(const amqp_bytes_t& fragment);
+    void end();
+
+    ~MappedSink();
+
+private:
+    void unmap(bool nothrow);
+
+    const SinkPathMaker path_maker_;
+    std::string path_;
+    char* data_;
+    size_t size_;
+    size_t written_;
+};
+
+// Forwards the sink calls to user functions; any of them may be empty.
+class CallbackSink: public BodySink
+{
+public:
+    typedef boost::function<void (uint64_t delivery_tag,
+                                  const amqp_basic_properties_t*,
+                                  uint64_t body_size)> BeginHandler;
+    typedef boost::function<void (const amqp_bytes_t&)> FragmentHandler;
+    typedef boost::function<void ()> EndHandler;
+
+    CallbackSink(const BeginHandler& on_begin,
+                 const FragmentHandler& on_fragment,
+                 const EndHandler& on_end = EndHandler()):
+        on_begin_(on_begin),
+        on_fragment_(on_fragment),
+        on_end_(on_end)
+    {}
+
+    void begin(uint64_t delivery_tag,
+               const amqp_basic_properties_t* properties,
+               uint64_t body_size)
+    {
+        if(on_begin_)
+            on_begin_(delivery_tag, properties, body_size);
+    }
+
+    void write(const amqp_bytes_t& fragment)
+    {
+        if(on_fragment_)
+            on_fragment_(fragment);
+    }
+
+    void end()
+    {
+        if(on_end_)
+            on_end_();
+    }
+
+private:
+    const BeginHandler on_begin_;
+    const FragmentHandler on_fragment_;
+    const EndHandler on_end_;
+};
+
+#endif // AMQP_BODY_SINK_HPP
@@ -42,6 +42,19 @@ struct ConsumeData
     amqp_table_t arguments;
 };
 
+struct QosData
+{
+    explicit QosData(uint16_t count, uint32_t size = 0):
+        prefetch_size(size),
+        prefetch_count(count),
+        global(0)
+    {}
+
+    uint32_t prefetch_size;
+    uint16_t prefetch_count;
+    amqp_boolean_t global;
+};
+
 struct PublishData
 {
     PublishData(amqp_bytes_t rk, const std::string& body,
@@ -80,6 +93,16 @@ public:
         check_rpc("Closing channel", reply, true);
     }
 
+    AmqpConnection& connection()
+    {
+        return conn_;
+    }
+
+    amqp_channel_t id() const
+    {
+        return channel_;
+    }
+
     const amqp_queue_declare_ok_t& queue_declare(const QueueData& data)
     {
         const amqp_queue_declare_ok_t* ok =
@@ -101,6 +124,13 @@ public:
         return *ok;
     }
 
+    void qos(const QosData& data)
+    {
+        amqp_basic_qos(conn_, channel_, data.prefetch_size,
+                       data.prefetch_count, data.global);
+        conn_.check_rpc("Setting QoS");
+    }
+
     void publish(PublishData& data)
     {
         amqp_basic_properties_t properties = data.message.properties;
@@ -114,12 +144,37 @@ public:
         check("Publishing", rc);
     }
 
+    void confirm_select()
+    {
+        amqp_confirm_select(conn_, channel_);
+        conn_.check_rpc("Selecting confirms");
+    }
+
     void ack(uint64_t delivery_tag, bool multiple = false)
     {
         const int rc = amqp_basic_ack(conn_, channel_, delivery_tag, multiple);
         check("Ack", rc);
     }
 
+    void nack(uint64_t delivery_tag, bool multiple = false,
+              bool requeue = true)
+    {
+        amqp_basic_nack_t nack;
+        nack.delivery_tag = delivery_tag;
+        nack.multiple = multiple;
+        nack.requeue = requeue;
+        const int rc = amqp_send_method(conn_, channel_,
+                                        AMQP_BASIC_NACK_METHOD, &nack);
+        check("Nack", rc);
+    }
+
+    void reject(uint64_t delivery_tag, bool requeue = true)
+    {
+        const int rc =
+                amqp_basic_reject(conn_, channel_, delivery_tag, requeue);
+        check("Reject", rc);
+    }
+
 private:
     AmqpConnection& conn_;
     const amqp_channel_t channel_;
@@ -0,0 +1,274 @@
+#include "amqp_channel_pool.hpp"
+#include <cerrno>
+#include <iostream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <boost/thread/thread.hpp>
+
+SocketWriter::SocketWriter(int sockfd):
+    sockfd_(sockfd),
+    queue_(128),
+    queued_(0),
+    writing_(false),
+    error_(0)
+{}
+
+void SocketWriter::submit(PendingWrite& batch)
+{
+    check("Publishing", error_);
+
+    batch.in_flight = true;
+    queued_.fetch_add(1, boost::memory_order_seq_cst);
+    queue_.push(&batch);
+    drain();
+}
+
+void SocketWriter::wait(PendingWrite& batch)
+{
+    while(batch.in_flight)
+    {
+        drain();
+        if(batch.in_flight)
+            boost::this_thread::yield();
+    }
+    check("Publishing", error_);
+}
+
+void SocketWriter::lock()
+{
+    while(writing_.exchange(true, boost::memory_order_acquire))
+        boost::this_thread::yield();
+}
+
+void SocketWriter::unlock()
+{
+    writing_.store(false, boost::memory_order_release);
+    drain();
+}
+
+void SocketWriter::drain()
+{
+    // queued_ is raised before taking the flag and read after releasing
+    // it, all seq_cst, so either the submitter wins the flag or the thread
+    // releasing it sees the batch and goes round again
+    while(queued_.load(boost::memory_order_seq_cst) > 0)
+    {
+        if(writing_.exchange(true, boost::memory_order_seq_cst))
+            return;
+        write_queued();
+        writing_.store(false, boost::memory_order_seq_cst);
+    }
+}
+
+void SocketWriter::write_queued()
+{
+    PendingWrite* batches[max_iov];
+    size_t count = 0;
+
+    while(true)
+    {
+        const bool popped = count < max_iov && queue_.pop(batches[count]);
+        if(popped)
+        {
+            ++count;
+            queued_.fetch_sub(1, boost::memory_order_relaxed);
+        }
+
+        if(count == 0)
+            return;
+
+        if(!popped)
+        {
+            if(error_ == 0)
+                error_ = write(batches, count);
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                if(error_ == 0)
+                    batches[i]->frames.count_sent();
+                batches[i]->frames.clear();
+                batches[i]->in_flight.store(false,
+                                            boost::memory_order_release);
+            }
+            count = 0;
+        }
+    }
+}
+
+int SocketWriter::write(PendingWrite* const* batches, size_t count)
+{
+    iovec iov[max_iov];
+    for(size_t i = 0; i < count; ++i)
+    {
+        iov[i].iov_base = batches[i]->frames.data();
+        iov[i].iov_len = batches[i]->frames.size();
+    }
+
+    msghdr message = msghdr();
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+
+    while(message.msg_iovlen > 0)
+    {
+        const ssize_t rc = sendmsg(sockfd_, &message, MSG_NOSIGNAL);
+        if(rc < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            // a partly written frame leaves the connection unusable
+            return socket_error();
+        }
+
+        size_t sent = rc;
+        while(message.msg_iovlen > 0 && sent >= message.msg_iov->iov_len)
+        {
+            sent -= message.msg_iov->iov_len;
+            ++message.msg_iov;
+            --message.msg_iovlen;
+        }
+        if(message.msg_iovlen > 0)
+        {
+            message.msg_iov->iov_base =
+                    static_cast<char*>(message.msg_iov->iov_base) + sent;
+            message.msg_iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+ChannelPool::ChannelPool(AmqpConnection& conn, size_t max_channels,
+                         amqp_channel_t first_channel, size_t flush_size):
+    conn_(conn),
+    max_channels_(max_channels),
+    flush_size_(flush_size),
+    writer_(conn.sockfd()),
+    opening_(0),
+    next_channel_(first_channel)
+{
+    if(conn.transport() != 0)
+        throw std::logic_error("ChannelPool: the connection has a transport");
+}
+
+ChannelPool::~ChannelPool()
+{
+    SocketWriter::ScopedLock lock(writer_);
+    for(size_t i = 0; i < slots_.size(); ++i)
+        delete slots_[i];
+}
+
+ChannelPool::Slot& ChannelPool::acquire()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    while(free_.empty() && slots_.size() + opening_ >= max_channels_)
+        released_.wait(lock);
+
+    if(!free_.empty())
+    {
+        Slot* slot = free_.back();
+        free_.pop_back();
+        return *slot;
+    }
+
+    // the round trip of channel.open must not hold up releases and the
+    // leases of open channels; a failed open does not reuse its id
+    const amqp_channel_t id = next_channel_++;
+    ++opening_;
+    lock.unlock();
+
+    Slot* slot = 0;
+    try
+    {
+        SocketWriter::ScopedLock write_lock(writer_);
+        slot = new Slot(conn_, id, conn_.frame_max());
+    }
+    catch(...)
+    {
+        lock.lock();
+        --opening_;
+        released_.notify_one();
+        throw;
+    }
+
+    lock.lock();
+    --opening_;
+    slots_.push_back(slot);
+    return *slot;
+}
+
+void ChannelPool::release(Slot& slot)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    free_.push_back(&slot);
+    released_.notify_one();
+}
+
+ChannelLease::ChannelLease(ChannelPool& pool):
+    pool_(pool),
+    slot_(pool.acquire())
+{}
+
+void ChannelLease::publish(PublishData& data)
+{
+    amqp_basic_publish_t method;
+    method.ticket = 0;
+    method.exchange = data.exchange;
+    method.routing_key = data.routing_key;
+    method.mandatory = data.mandatory;
+    method.immediate = data.immediate;
+
+    const amqp_basic_properties_t properties = data.message.properties;
+    const amqp_bytes_t& body = data.message.body;
+    const amqp_channel_t channel = id();
+
+    FrameEncoder& frames = buffer();
+    frames.method(channel, AMQP_BASIC_PUBLISH_METHOD, &method);
+    frames.header(channel, body.len, properties);
+    frames.body(channel, body);
+    added();
+}
+
+void ChannelLease::publish(const PublishTemplate& publish_template,
+                           const amqp_bytes_t& body,
+                           const PublishFields& fields)
+{
+    if(publish_template.channel_id() != id())
+        throw std::invalid_argument("publish template for another channel");
+
+    publish_template.encode(buffer(), body, fields);
+    added();
+}
+
+void ChannelLease::added()
+{
+    if(buffer().size() >= pool_.flush_size_)
+        flush();
+}
+
+void ChannelLease::flush()
+{
+    PendingWrite& full = *slot_.buffers[slot_.current];
+    if(full.frames.empty())
+        return;
+
+    SocketWriter& writer = pool_.writer_;
+    writer.submit(full);
+
+    slot_.current ^= 1;
+    writer.wait(*slot_.buffers[slot_.current]);
+}
+
+ChannelLease::~ChannelLease()
+{
+    try
+    {
+        flush();
+        // the next lease of the channel must find both buffers free
+        pool_.writer_.wait(*slot_.buffers[slot_.current ^ 1]);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Flushing channel lease: " << e.what() << std::endl;
+    }
+    pool_.release(slot_);
+}
@@ -0,0 +1,209 @@
+#ifndef AMQP_CHANNEL_POOL_HPP
+#define AMQP_CHANNEL_POOL_HPP
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "amqp_channel.hpp"
+#include "amqp_encoder.hpp"
+#include "amqp_publish_template.hpp"
+
+// An encoded batch of frames waiting to be written by a SocketWriter.
+struct PendingWrite: boost::noncopyable
+{
+    explicit PendingWrite(size_t frame_max):
+        frames(frame_max),
+        in_flight(false)
+    {}
+
+    FrameEncoder frames;
+    boost::atomic<bool> in_flight;
+};
+
+// Serializes writes from many threads onto one socket without a mutex.
+// submit() queues a batch on a lock-free queue; whichever thread then wins
+// the writing flag drains everything queued, by all threads, with
+// sendmsg() over an iovec, and marks each batch done. Threads that lose
+// return at once and find their batch written later.
+//
+// Any other write to the socket (librabbitmq RPCs, acks) must happen while
+// holding a ScopedLock, or it may land in the middle of a batch.
+class SocketWriter: boost::noncopyable
+{
+public:
+    class ScopedLock: boost::noncopyable
+    {
+    public:
+        explicit ScopedLock(SocketWriter& writer):
+            writer_(writer)
+        {
+            writer_.lock();
+        }
+
+        ~ScopedLock()
+        {
+            writer_.unlock();
+        }
+
+    private:
+        SocketWriter& writer_;
+    };
+
+    explicit SocketWriter(int sockfd);
+
+    // The batch must not be touched until in_flight is false again.
+    void submit(PendingWrite& batch);
+
+    // Helps draining until the batch has been written; throws if the
+    // socket failed.
+    void wait(PendingWrite& batch);
+
+    // 0, or the librabbitmq-style error code of the first failed write;
+    // once set, queued and later batches are discarded.
+    int error() const
+    {
+        return error_;
+    }
+
+private:
+    static const size_t max_iov = 64;
+
+    void lock();
+    void unlock();
+    void drain();
+    void write_queued();
+    int write(PendingWrite* const* batches, size_t count);
+
+    const int sockfd_;
+    boost::lockfree::queue<PendingWrite*> queue_;
+    boost::atomic<size_t> queued_; // counted before the push, so never low
+    boost::atomic<bool> writing_;
+    boost::atomic<int> error_;
+};
+
+class ChannelLease;
+
+// Hands out channels of one shared connection to application threads.
+// Channels are opened on first demand, up to max_channels, and reused
+// after their lease ends; lease() waits when all of them are taken. Every
+// channel keeps two publish buffers, so a thread keeps encoding into one
+// while the other is being written. Publishing itself takes no lock;
+// only leasing and returning a channel do.
+//
+// Channels are opened with synchronous RPCs, so no other thread may be
+// reading the connection while a lease opens a new one. The batches go
+// straight to the socket, so a connection with a Transport installed is
+// refused with std::logic_error.
+class ChannelPool: boost::noncopyable
+{
+public:
+    ChannelPool(AmqpConnection& conn, size_t max_channels,
+                amqp_channel_t first_channel = 1,
+                size_t flush_size = 1 << 16);
+
+    AmqpConnection& connection()
+    {
+        return conn_;
+    }
+
+    SocketWriter& writer()
+    {
+        return writer_;
+    }
+
+    size_t open_channels() const
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return slots_.size();
+    }
+
+    ~ChannelPool();
+
+private:
+    friend class ChannelLease;
+
+    struct Slot: boost::noncopyable
+    {
+        Slot(AmqpConnection& conn, amqp_channel_t id, size_t frame_max):
+            channel(conn, id),
+            current(0)
+        {
+            buffers[0] = new PendingWrite(frame_max);
+            buffers[1] = new PendingWrite(frame_max);
+            buffers[0]->frames.metrics(conn.metrics());
+            buffers[1]->frames.metrics(conn.metrics());
+        }
+
+        ~Slot()
+        {
+            delete buffers[0];
+            delete buffers[1];
+        }
+
+        AmqpChannel channel;
+        PendingWrite* buffers[2];
+        int current;
+    };
+
+    Slot& acquire();
+    void release(Slot& slot);
+
+    AmqpConnection& conn_;
+    const size_t max_channels_;
+    const size_t flush_size_;
+    SocketWriter writer_;
+
+    mutable boost::mutex mutex_;
+    boost::condition_variable released_;
+    std::vector<Slot*> slots_;
+    std::vector<Slot*> free_;
+    size_t opening_; // channels being opened outside the mutex
+    amqp_channel_t next_channel_;
+};
+
+// One thread's exclusive use of a pooled channel. Publishes are encoded
+// into the channel's own buffer and handed to the pool's SocketWriter when
+// it reaches the pool's flush size, on flush(), and when the lease ends.
+// Use channel() for synchronous calls, holding a SocketWriter::ScopedLock.
+class ChannelLease: boost::noncopyable
+{
+public:
+    explicit ChannelLease(ChannelPool& pool);
+
+    AmqpChannel& channel()
+    {
+        return slot_.channel;
+    }
+
+    amqp_channel_t id() const
+    {
+        return slot_.channel.id();
+    }
+
+    void publish(PublishData& data);
+
+    // Throws std::invalid_argument if the template is for another channel.
+    void publish(const PublishTemplate& publish_template,
+                 const amqp_bytes_t& body,
+                 const PublishFields& fields = PublishFields());
+
+    // Hands the buffered frames to the writer without waiting for them.
+    void flush();
+
+    ~ChannelLease();
+
+private:
+    FrameEncoder& buffer()
+    {
+        return slot_.buffers[slot_.current]->frames;
+    }
+
+    void added();
+
+    ChannelPool& pool_;
+    ChannelPool::Slot& slot_;
+};
+
+#endif // AMQP_CHANNEL_POOL_HPP
@@ -0,0 +1,223 @@
+#include "amqp_codec.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <boost/chrono.hpp>
+#include <lz4.h>
+#include <zlib.h>
+#include "amqp_table_view.hpp"
+
+namespace
+{
+    typedef boost::chrono::steady_clock Clock;
+
+    inline uint64_t elapsed_ns(Clock::time_point start)
+    {
+        return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                    Clock::now() - start).count();
+    }
+
+    inline bool equal(const amqp_bytes_t& bytes, const char* text)
+    {
+        const size_t len = strlen(text);
+        return bytes.len == len && memcmp(bytes.bytes, text, len) == 0;
+    }
+
+    inline void count(boost::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.fetch_add(value, boost::memory_order_relaxed);
+    }
+
+    inline uint64_t load(const boost::atomic<uint64_t>& counter)
+    {
+        return counter.load(boost::memory_order_relaxed);
+    }
+}
+
+size_t ZlibCodec::max_compressed_size(size_t size) const
+{
+    return compressBound(size);
+}
+
+size_t ZlibCodec::compress(const amqp_bytes_t& in, char* out,
+                           size_t capacity) const
+{
+    uLongf out_len = capacity;
+    const int rc = compress2(reinterpret_cast<Bytef*>(out), &out_len,
+                             static_cast<const Bytef*>(in.bytes), in.len,
+                             level_);
+    if(rc != Z_OK)
+        throw std::runtime_error("deflate: compression failed");
+    return out_len;
+}
+
+size_t ZlibCodec::decompress(const amqp_bytes_t& in, char* out,
+                             size_t capacity) const
+{
+    uLongf out_len = capacity;
+    const int rc = uncompress(reinterpret_cast<Bytef*>(out), &out_len,
+                              static_cast<const Bytef*>(in.bytes), in.len);
+    if(rc != Z_OK || out_len != capacity)
+        throw std::runtime_error("deflate: corrupt body");
+    return out_len;
+}
+
+size_t Lz4Codec::max_compressed_size(size_t size) const
+{
+    return LZ4_compressBound(static_cast<int>(size));
+}
+
+size_t Lz4Codec::compress(const amqp_bytes_t& in, char* out,
+                          size_t capacity) const
+{
+    const int rc = LZ4_compress_fast(static_cast<const char*>(in.bytes), out,
+                                     static_cast<int>(in.len),
+                                     static_cast<int>(capacity),
+                                     acceleration_);
+    if(rc <= 0)
+        throw std::runtime_error("lz4: compression failed");
+    return rc;
+}
+
+size_t Lz4Codec::decompress(const amqp_bytes_t& in, char* out,
+                            size_t capacity) const
+{
+    const int rc = LZ4_decompress_safe(static_cast<const char*>(in.bytes),
+                                       out, static_cast<int>(in.len),
+                                       static_cast<int>(capacity));
+    if(rc < 0 || static_cast<size_t>(rc) != capacity)
+        throw std::runtime_error("lz4: corrupt body");
+    return rc;
+}
+
+const char* const CompressionStage::length_header = "x-uncompressed-length";
+
+CompressionStage::CompressionStage(BodyBufferPool& pool, size_t threshold,
+                                   size_t max_size):
+    pool_(pool),
+    threshold_(threshold),
+    max_size_(max_size),
+    publish_()
+{}
+
+void CompressionStage::add(BodyCodec* codec)
+{
+    entries_.push_back(new Entry(codec));
+    if(publish_ == 0)
+        publish_ = &entries_.back();
+}
+
+void CompressionStage::publish_codec(const std::string& name)
+{
+    Entry* entry = find(to_amqp_bytes(name));
+    if(entry == 0)
+        throw std::invalid_argument("unknown codec: " + name);
+    publish_ = entry;
+}
+
+CompressionStage::Entry* CompressionStage::find(const amqp_bytes_t& name)
+{
+    for(size_t i = 0; i < entries_.size(); ++i)
+    {
+        if(equal(name, entries_[i].codec->name()))
+            return &entries_[i];
+    }
+    return 0;
+}
+
+const CompressionStage::Entry*
+CompressionStage::find(const amqp_bytes_t& name) const
+{
+    return const_cast<CompressionStage*>(this)->find(name);
+}
+
+bool CompressionStage::compress(PublishData& data)
+{
+    AmqpProperties& properties = data.message.properties;
+    const amqp_bytes_t& body = data.message.body;
+
+    if(publish_ == 0 || body.len < threshold_ ||
+            (properties.flags() & AMQP_BASIC_CONTENT_ENCODING_FLAG) != 0)
+        return false;
+
+    Entry& entry = *publish_;
+    const BodyCodec& codec = *entry.codec;
+    const BodyBufferPtr scratch =
+            pool_.acquire(codec.max_compressed_size(body.len));
+
+    const Clock::time_point start = Clock::now();
+    const size_t size =
+            codec.compress(body, scratch->data(), scratch->capacity());
+    count(entry.compress_ns, elapsed_ns(start));
+
+    if(size >= body.len)
+    {
+        count(entry.skipped, 1);
+        return false;
+    }
+
+    count(entry.compressed, 1);
+    count(entry.compress_in, body.len);
+    count(entry.compress_out, size);
+
+    // the caller's headers may be shared with other threads' messages
+    AmqpTable headers = properties.headers().fork();
+    headers.add(std::string(length_header), static_cast<int64_t>(body.len));
+    properties.headers(headers);
+    properties.content_encoding(amqp_cstring_bytes(codec.name()));
+
+    amqp_bytes_t compressed;
+    compressed.bytes = scratch->data();
+    compressed.len = size;
+    data.message.body = compressed;
+    return true;
+}
+
+BodyBufferPtr CompressionStage::decompress(
+        const amqp_basic_properties_t& properties, const amqp_bytes_t& body)
+{
+    if((properties._flags & AMQP_BASIC_CONTENT_ENCODING_FLAG) == 0)
+        return BodyBufferPtr();
+
+    Entry* entry = find(properties.content_encoding);
+    if(entry == 0)
+        return BodyBufferPtr();
+
+    AmqpFieldView length;
+    if((properties._flags & AMQP_BASIC_HEADERS_FLAG) != 0)
+        length = AmqpTableView(properties.headers).find(length_header);
+    if(!length.is_integer() || length.integer() < 0)
+        throw std::runtime_error("compressed body without its length");
+    if(static_cast<uint64_t>(length.integer()) > max_size_)
+        throw std::runtime_error("compressed body too large");
+
+    const size_t size = static_cast<size_t>(length.integer());
+    BodyBufferPtr result = pool_.acquire(size);
+
+    const Clock::time_point start = Clock::now();
+    entry->codec->decompress(body, result->extend(size), size);
+    count(entry->decompress_ns, elapsed_ns(start));
+
+    count(entry->decompressed, 1);
+    count(entry->decompress_in, body.len);
+    count(entry->decompress_out, size);
+    return result;
+}
+
+CodecStats CompressionStage::stats(const std::string& name) const
+{
+    CodecStats result;
+    const Entry* entry = find(to_amqp_bytes(name));
+    if(entry == 0)
+        return result;
+
+    result.compressed = load(entry->compressed);
+    result.compress_in = load(entry->compress_in);
+    result.compress_out = load(entry->compress_out);
+    result.compress_ns = load(entry->compress_ns);
+    result.skipped = load(entry->skipped);
+    result.decompressed = load(entry->decompressed);
+    result.decompress_in = load(entry->decompress_in);
+    result.decompress_out = load(entry->decompress_out);
+    result.decompress_ns = load(entry->decompress_ns);
+    return result;
+}
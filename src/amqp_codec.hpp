@@ -0,0 +1,183 @@
+#ifndef AMQP_CODEC_HPP
+#define AMQP_CODEC_HPP
+
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include "amqp_body_pool.hpp"
+#include "amqp_channel.hpp"
+
+// A body compression format, named by its content_encoding value.
+// Implementations must be usable from several threads at once.
+class BodyCodec: boost::noncopyable
+{
+public:
+    virtual const char* name() const = 0;
+    virtual size_t max_compressed_size(size_t size) const = 0;
+
+    // Both return the number of bytes written to out; compress() throws if
+    // the codec fails, decompress() also if the result is not exactly
+    // capacity bytes long.
+    virtual size_t compress(const amqp_bytes_t& in, char* out,
+                            size_t capacity) const = 0;
+    virtual size_t decompress(const amqp_bytes_t& in, char* out,
+                              size_t capacity) const = 0;
+
+    virtual ~BodyCodec()
+    {}
+};
+
+// zlib stream format, content_encoding "deflate".
+class ZlibCodec: public BodyCodec
+{
+public:
+    explicit ZlibCodec(int level = 6):
+        level_(level)
+    {}
+
+    const char* name() const
+    {
+        return "deflate";
+    }
+
+    size_t max_compressed_size(size_t size) const;
+    size_t compress(const amqp_bytes_t& in, char* out, size_t capacity) const;
+    size_t decompress(const amqp_bytes_t& in, char* out,
+                      size_t capacity) const;
+
+private:
+    const int level_;
+};
+
+// LZ4 block format, content_encoding "lz4"; much faster than zlib at a
+// lower ratio.
+class Lz4Codec: public BodyCodec
+{
+public:
+    explicit Lz4Codec(int acceleration = 1):
+        acceleration_(acceleration)
+    {}
+
+    const char* name() const
+    {
+        return "lz4";
+    }
+
+    size_t max_compressed_size(size_t size) const;
+    size_t compress(const amqp_bytes_t& in, char* out, size_t capacity) const;
+    size_t decompress(const amqp_bytes_t& in, char* out,
+                      size_t capacity) const;
+
+private:
+    const int acceleration_;
+};
+
+// Point-in-time copy of a codec's counters.
+struct CodecStats
+{
+    CodecStats():
+        compressed(),
+        compress_in(),
+        compress_out(),
+        compress_ns(),
+        skipped(),
+        decompressed(),
+        decompress_in(),
+        decompress_out(),
+        decompress_ns()
+    {}
+
+    // compressed size over original size of the published bodies
+    double ratio() const
+    {
+        return compress_in == 0 ? 1.0 : double(compress_out) / compress_in;
+    }
+
+    uint64_t compressed;
+    uint64_t compress_in;
+    uint64_t compress_out;
+    uint64_t compress_ns;
+    uint64_t skipped; // bodies sent as is because they did not shrink
+    uint64_t decompressed;
+    uint64_t decompress_in;
+    uint64_t decompress_out;
+    uint64_t decompress_ns;
+};
+
+// Optional compression of message bodies keyed on content_encoding. On
+// publish, bodies of at least threshold bytes that carry no
+// content_encoding yet are compressed with the publish codec, if that
+// makes them smaller; the original length goes into the
+// x-uncompressed-length header. On consume, a body whose content_encoding
+// names a registered codec is decompressed into a buffer from the pool.
+// The length header comes from the sender, so a body claiming more than
+// max_size bytes is refused before any buffer is taken. A stage may be
+// shared between threads once its codecs are added.
+class CompressionStage: boost::noncopyable
+{
+public:
+    static const char* const length_header;
+
+    explicit CompressionStage(BodyBufferPool& pool, size_t threshold = 1024,
+                              size_t max_size = 128 << 20);
+
+    // Takes ownership. The first codec added is the publish codec.
+    void add(BodyCodec* codec);
+    void publish_codec(const std::string& name);
+
+    // Returns true if the body was replaced by its compressed form.
+    bool compress(PublishData& data);
+
+    // Returns a null pointer if the body is not encoded with a registered
+    // codec, so the caller uses it as it is. Throws if the length header
+    // is missing or above max_size, or the body does not decompress to
+    // exactly that length.
+    BodyBufferPtr decompress(const amqp_basic_properties_t& properties,
+                             const amqp_bytes_t& body);
+
+    CodecStats stats(const std::string& name) const;
+
+private:
+    struct Entry: boost::noncopyable
+    {
+        explicit Entry(BodyCodec* c):
+            codec(c),
+            compressed(0),
+            compress_in(0),
+            compress_out(0),
+            compress_ns(0),
+            skipped(0),
+            decompressed(0),
+            decompress_in(0),
+            decompress_out(0),
+            decompress_ns(0)
+        {}
+
+        ~Entry()
+        {
+            delete codec;
+        }
+
+        BodyCodec* const codec;
+        boost::atomic<uint64_t> compressed;
+        boost::atomic<uint64_t> compress_in;
+        boost::atomic<uint64_t> compress_out;
+        boost::atomic<uint64_t> compress_ns;
+        boost::atomic<uint64_t> skipped;
+        boost::atomic<uint64_t> decompressed;
+        boost::atomic<uint64_t> decompress_in;
+        boost::atomic<uint64_t> decompress_out;
+        boost::atomic<uint64_t> decompress_ns;
+    };
+
+    Entry* find(const amqp_bytes_t& name);
+    const Entry* find(const amqp_bytes_t& name) const;
+
+    BodyBufferPool& pool_;
+    const size_t threshold_;
+    const size_t max_size_;
+    boost::ptr_vector<Entry> entries_;
+    Entry* publish_;
+};
+
+#endif // AMQP_CODEC_HPP
@@ -0,0 +1,163 @@
+#include "amqp_confirm.hpp"
+#include <cassert>
+
+namespace
+{
+    inline bool is_method(const amqp_frame_t& frame, amqp_method_number_t id)
+    {
+        return frame.frame_type == AMQP_FRAME_METHOD &&
+                frame.payload.method.id == id;
+    }
+
+    template<typename T> inline const T* decoded(const amqp_frame_t& frame)
+    {
+        return static_cast<const T*>(frame.payload.method.decoded);
+    }
+}
+
+ConfirmTracker::ConfirmTracker(AmqpChannel& channel, size_t max_in_flight):
+    channel_(channel),
+    max_in_flight_(max_in_flight),
+    next_tag_(1),
+    first_tag_(1),
+    in_flight_()
+{
+    assert(max_in_flight_ > 0);
+    channel_.confirm_select();
+}
+
+uint64_t ConfirmTracker::publish(PublishData& data,
+                                 const ConfirmCallback& callback)
+{
+    wait_window();
+    channel_.publish(data);
+    return track(callback);
+}
+
+uint64_t ConfirmTracker::track(const ConfirmCallback& callback)
+{
+    pending_.push_back(Pending(callback));
+    ++in_flight_;
+    return next_tag_++;
+}
+
+bool ConfirmTracker::process_frame(const amqp_frame_t& frame)
+{
+    if(frame.channel != channel_.id())
+        return false;
+
+    if(is_method(frame, AMQP_BASIC_ACK_METHOD))
+    {
+        const amqp_basic_ack_t* ack = decoded<amqp_basic_ack_t>(frame);
+        confirm(ack->delivery_tag, ack->multiple, true);
+        return true;
+    }
+
+    if(is_method(frame, AMQP_BASIC_NACK_METHOD))
+    {
+        const amqp_basic_nack_t* nack = decoded<amqp_basic_nack_t>(frame);
+        confirm(nack->delivery_tag, nack->multiple, false);
+        return true;
+    }
+
+    return false;
+}
+
+void ConfirmTracker::confirm(uint64_t delivery_tag, bool multiple, bool acked)
+{
+    if(delivery_tag < first_tag_ || delivery_tag >= next_tag_)
+    {
+        // tag 0 with multiple set confirms everything outstanding
+        if(!(multiple && delivery_tag == 0))
+            return;
+        delivery_tag = next_tag_ - 1;
+    }
+
+    Ready ready;
+    const size_t index = delivery_tag - first_tag_;
+    if(multiple)
+    {
+        for(size_t i = 0; i <= index; ++i)
+            complete(first_tag_ + i, pending_[i], ready);
+    }
+    else
+        complete(delivery_tag, pending_[index], ready);
+
+    while(!pending_.empty() && pending_.front().done)
+    {
+        pending_.pop_front();
+        ++first_tag_;
+    }
+
+    // a callback that publishes may wait and confirm more, which changes
+    // pending_
+    for(size_t i = 0; i < ready.size(); ++i)
+        ready[i].second(ready[i].first, acked);
+}
+
+void ConfirmTracker::complete(uint64_t delivery_tag, Pending& pending,
+                              Ready& ready)
+{
+    if(pending.done)
+        return;
+
+    pending.done = true;
+    --in_flight_;
+    if(pending.callback)
+    {
+        ready.push_back(std::make_pair(delivery_tag, ConfirmCallback()));
+        ready.back().second.swap(pending.callback);
+    }
+}
+
+void ConfirmTracker::wait_window()
+{
+    if(in_flight_ >= max_in_flight_)
+        wait_until(max_in_flight_ - 1);
+}
+
+void ConfirmTracker::wait_all()
+{
+    wait_until(0);
+}
+
+void ConfirmTracker::wait_until(size_t in_flight)
+{
+    AmqpConnection& conn = channel_.connection();
+    amqp_frame_t frame;
+
+    while(in_flight_ > in_flight)
+    {
+        const int rc = conn.wait_frame(frame);
+        check("Waiting for confirms", rc);
+
+        if(is_method(frame, AMQP_CONNECTION_CLOSE_METHOD) ||
+           (frame.channel == channel_.id() &&
+            is_method(frame, AMQP_CHANNEL_CLOSE_METHOD)))
+            closed(frame);
+
+        if(process_frame(frame) || !unhandled_)
+            conn.release_buffers();
+        else
+            unhandled_(frame);
+    }
+}
+
+void ConfirmTracker::closed(const amqp_frame_t& frame)
+{
+    AmqpConnection& conn = channel_.connection();
+    amqp_rpc_reply_t reply = amqp_rpc_reply_t();
+    reply.reply_type = AMQP_RESPONSE_SERVER_EXCEPTION;
+    reply.reply = frame.payload.method;
+    const AmqpRpcError error("Waiting for confirms", reply);
+
+    if(frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD)
+    {
+        amqp_channel_close_ok_t close_ok;
+        check("Closing channel",
+              amqp_send_method(conn, frame.channel,
+                               AMQP_CHANNEL_CLOSE_OK_METHOD, &close_ok), true);
+    }
+    conn.release_buffers();
+    throw error;
+}
@@ -0,0 +1,83 @@
+#ifndef AMQP_CONFIRM_HPP
+#define AMQP_CONFIRM_HPP
+
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include "amqp_channel.hpp"
+
+typedef boost::function<void (uint64_t delivery_tag, bool acked)>
+    ConfirmCallback;
+
+// Puts the channel in confirm mode and tracks outstanding publishes by
+// sequence number. Broker basic.ack/basic.nack frames, single or multiple,
+// complete the matching callbacks in order. At most max_in_flight publishes
+// are outstanding; publish() waits for confirms when the window is full.
+// Callbacks run after the tracker is updated, so they may publish again.
+class ConfirmTracker: boost::noncopyable
+{
+public:
+    explicit ConfirmTracker(AmqpChannel& channel, size_t max_in_flight = 1024);
+
+    // Publishes through the channel and tracks the message.
+    uint64_t publish(PublishData& data,
+                     const ConfirmCallback& callback = ConfirmCallback());
+
+    // Tracks a message published by other means (e.g. PublishBatch);
+    // must be called once per message, in publish order.
+    uint64_t track(const ConfirmCallback& callback = ConfirmCallback());
+
+    // Returns true if the frame was a confirm for this channel.
+    bool process_frame(const amqp_frame_t& frame);
+
+    // Throw AmqpRpcError when the broker closes the channel or connection
+    // while confirms are outstanding.
+    void wait_window();
+    void wait_all();
+
+    size_t in_flight() const
+    {
+        return in_flight_;
+    }
+
+    size_t max_in_flight() const
+    {
+        return max_in_flight_;
+    }
+
+    // Receives frames read while waiting that are not confirms. Their
+    // buffers are not released; the handler owns that decision.
+    void unhandled_frame_handler(const FrameHandler& handler)
+    {
+        unhandled_ = handler;
+    }
+
+private:
+    struct Pending
+    {
+        Pending(const ConfirmCallback& cb):
+            callback(cb),
+            done(false)
+        {}
+
+        ConfirmCallback callback;
+        bool done;
+    };
+
+    typedef std::vector<std::pair<uint64_t, ConfirmCallback> > Ready;
+
+    void confirm(uint64_t delivery_tag, bool multiple, bool acked);
+    void complete(uint64_t delivery_tag, Pending& pending, Ready& ready);
+    void wait_until(size_t in_flight);
+    void closed(const amqp_frame_t& frame);
+
+    AmqpChannel& channel_;
+    const size_t max_in_flight_;
+    uint64_t next_tag_;
+    uint64_t first_tag_;
+    size_t in_flight_;
+    std::deque<Pending> pending_;
+    FrameHandler unhandled_;
+};
+
+#endif // AMQP_CONFIRM_HPP
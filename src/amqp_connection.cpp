@@ -1,11 +1,134 @@
 #include "amqp_connection.hpp"
+#include <cerrno>
 #include <cstdlib>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <boost/chrono.hpp>
 
-AmqpConnection::AmqpConnection(const std::string& host, int port)
+namespace
 {
-    const int sockfd = amqp_open_socket(host.c_str(), port);
+    inline void set_option(int sockfd, int level, int name, int value,
+                           const char* context)
+    {
+        const int rc = setsockopt(sockfd, level, name, &value, sizeof value);
+        check_os(context, rc);
+    }
+
+    void set_socket_options(int sockfd, const ConnectionOptions& options)
+    {
+        if(options.tcp_nodelay)
+            set_option(sockfd, IPPROTO_TCP, TCP_NODELAY, 1,
+                       "Setting TCP_NODELAY");
+
+        if(options.send_buffer > 0)
+            set_option(sockfd, SOL_SOCKET, SO_SNDBUF, options.send_buffer,
+                       "Setting SO_SNDBUF");
+
+        if(options.receive_buffer > 0)
+            set_option(sockfd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer,
+                       "Setting SO_RCVBUF");
+
+#ifdef SO_BUSY_POLL
+        if(options.busy_poll > 0)
+            set_option(sockfd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll,
+                       "Setting SO_BUSY_POLL");
+#endif
+    }
+
+    // Makes the socket non-blocking while in scope.
+    class NonBlocking: boost::noncopyable
+    {
+    public:
+        explicit NonBlocking(int sockfd):
+            sockfd_(sockfd),
+            flags_(fcntl(sockfd, F_GETFL))
+        {
+            check_os("Reading socket flags", flags_);
+            check_os("Setting O_NONBLOCK",
+                     fcntl(sockfd, F_SETFL, flags_ | O_NONBLOCK));
+        }
+
+        ~NonBlocking()
+        {
+            check_os("Clearing O_NONBLOCK", fcntl(sockfd_, F_SETFL, flags_),
+                     true);
+        }
+
+    private:
+        int sockfd_;
+        int flags_;
+    };
+}
+
+AmqpConnection::AmqpConnection(const std::string& host, int port):
+    options_(host, port),
+    metrics_(),
+    transport_(),
+    heartbeat_()
+{
+    open();
+}
+
+AmqpConnection::AmqpConnection(const ConnectionOptions& options):
+    options_(options),
+    metrics_(),
+    transport_(),
+    heartbeat_()
+{
+    open();
+}
+
+void AmqpConnection::open()
+{
+    const int sockfd = amqp_open_socket(options_.host.c_str(), options_.port);
+    check("Opening socket", sockfd);
     amqp_set_sockfd(state_, sockfd);
-    const amqp_rpc_reply_t reply = amqp_login(state_, "/", 0, 131072,
-                     0, AMQP_SASL_METHOD_PLAIN, "guest", "guest");
+    set_socket_options(sockfd, options_);
+
+    const int heartbeat =
+            options_.heartbeat_driven ? options_.heartbeat : 0;
+    const amqp_rpc_reply_t reply =
+            amqp_login(state_, options_.vhost.c_str(), options_.channel_max,
+                       options_.frame_max, heartbeat,
+                       AMQP_SASL_METHOD_PLAIN, options_.user.c_str(),
+                       options_.password.c_str());
     ::check_rpc("Logging in", reply);
+    heartbeat_ = heartbeat;
+}
+
+// librabbitmq 0.3 has no timed wait. On a non-blocking socket its recv()
+// fails with EAGAIN instead, keeping what it decoded so far, and the
+// socket is polled for the rest.
+int AmqpConnection::wait_frame(amqp_frame_t& frame, int timeout_ms)
+{
+    if(timeout_ms < 0)
+        return wait_frame(frame);
+
+    using namespace boost::chrono;
+    const steady_clock::time_point deadline =
+            steady_clock::now() + milliseconds(timeout_ms);
+
+    NonBlocking non_blocking(sockfd());
+    for(;;)
+    {
+        const int rc = wait_frame(frame);
+        if(rc != os_error(EAGAIN) && rc != os_error(EINTR))
+            return rc;
+
+        const steady_clock::duration left = deadline - steady_clock::now();
+        pollfd fd = pollfd();
+        fd.fd = sockfd();
+        fd.events = POLLIN;
+
+        const int wait_ms = left > steady_clock::duration::zero()
+                ? static_cast<int>(ceil<milliseconds>(left).count()) : 0;
+        const int ready = poll(&fd, 1, wait_ms);
+        if(ready == 0)
+            return os_error(ETIMEDOUT);
+        if(ready < 0 && errno != EINTR)
+            return socket_error();
+    }
 }
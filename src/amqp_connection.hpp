@@ -3,9 +3,61 @@
 
 #include <string>
 #include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
 #include <amqp.h>
+#include "amqp_metrics.hpp"
+#include "amqp_transport.hpp"
 #include "error.hpp"
 
+typedef boost::function<void (const amqp_frame_t&)> FrameHandler;
+
+// Login parameters and socket options of a connection. channel_max,
+// frame_max and heartbeat are what the client proposes in tune-ok; 0
+// means no limit (no heartbeat). Zero buffer sizes and busy_poll keep the
+// system defaults. See ConnectionTuner for picking frame_max and the
+// buffer sizes by measurement.
+//
+// Blocking calls send no heartbeats, so the broker would close an idle
+// connection after two intervals. heartbeat is therefore only proposed
+// when heartbeat_driven says that something sends them: an AmqpEventLoop
+// the connection is added to, or PublishSpool for its own connection.
+// Otherwise 0 is proposed.
+struct ConnectionOptions
+{
+    explicit ConnectionOptions(const std::string& h = "localhost",
+                               int p = 5672):
+        host(h),
+        port(p),
+        vhost("/"),
+        user("guest"),
+        password("guest"),
+        channel_max(0),
+        frame_max(131072),
+        heartbeat(0),
+        heartbeat_driven(false),
+        tcp_nodelay(false),
+        send_buffer(0),
+        receive_buffer(0),
+        busy_poll(0)
+    {}
+
+    std::string host;
+    int port;
+    std::string vhost;
+    std::string user;
+    std::string password;
+
+    int channel_max;
+    int frame_max;
+    int heartbeat; // seconds
+    bool heartbeat_driven;
+
+    bool tcp_nodelay;
+    int send_buffer; // SO_SNDBUF, bytes
+    int receive_buffer; // SO_RCVBUF, bytes
+    int busy_poll; // SO_BUSY_POLL, microseconds
+};
+
 class ConnectionState: boost::noncopyable
 {
 public:
@@ -32,6 +84,35 @@ class AmqpConnection: boost::noncopyable
 {
 public:
     explicit AmqpConnection(const std::string& host = "localhost", int port = 5672);
+    explicit AmqpConnection(const ConnectionOptions& options);
+
+    const ConnectionOptions& options() const
+    {
+        return options_;
+    }
+
+    // Not owned; null (the default) disables metrics.
+    void metrics(ConnectionMetrics* metrics)
+    {
+        metrics_ = metrics;
+    }
+
+    ConnectionMetrics* metrics() const
+    {
+        return metrics_;
+    }
+
+    // Not owned; null (the default) means FrameReader and FrameEncoder
+    // use the socket directly.
+    void transport(Transport* transport)
+    {
+        transport_ = transport;
+    }
+
+    Transport* transport() const
+    {
+        return transport_;
+    }
 
     operator amqp_connection_state_t()
     {
@@ -44,11 +125,35 @@ public:
         ::check_rpc(context, reply, nothrow);
     }
 
+    int sockfd()
+    {
+        return amqp_get_sockfd(state_);
+    }
+
+    int frame_max()
+    {
+        return amqp_get_frame_max(state_);
+    }
+
+    // Interval proposed in tune-ok in seconds, 0 if none. librabbitmq 0.3
+    // does not report the tune it received; it lowers the proposal to a
+    // smaller interval the broker asks for, so keep options().heartbeat
+    // within the broker's.
+    int heartbeat() const
+    {
+        return heartbeat_;
+    }
+
     int wait_frame(amqp_frame_t& frame)
     {
         return amqp_simple_wait_frame(state_, &frame);
     }
 
+    // Waits up to timeout_ms (-1 for no limit) and returns
+    // os_error(ETIMEDOUT) if no whole frame arrived in time. librabbitmq
+    // keeps the part of a frame it read until the next call.
+    int wait_frame(amqp_frame_t& frame, int timeout_ms);
+
     void release_buffers()
     {
         amqp_maybe_release_buffers(state_);
@@ -62,7 +167,13 @@ public:
     }
 
 private:
+    void open();
+
     ConnectionState state_;
+    ConnectionOptions options_;
+    ConnectionMetrics* metrics_;
+    Transport* transport_;
+    int heartbeat_;
 };
 
 #endif // CONNECTION_HPP
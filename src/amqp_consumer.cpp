@@ -0,0 +1,147 @@
+#include "amqp_consumer.hpp"
+#include <iostream>
+
+Delivery::Delivery(ConsumerRuntime& runtime, amqp_channel_t channel,
+                   const AmqpVisitor& visitor):
+    runtime_(runtime),
+    channel_(channel),
+    delivery_tag_(visitor.delivery_tag()),
+    properties_(visitor.properties()),
+    body_(visitor.body_buffer())
+{}
+
+void Delivery::ack()
+{
+    runtime_.complete(channel_, delivery_tag_,
+                      ConsumerRuntime::ack_completion, false);
+}
+
+void Delivery::nack(bool requeue)
+{
+    runtime_.complete(channel_, delivery_tag_,
+                      ConsumerRuntime::nack_completion, requeue);
+}
+
+void Delivery::reject(bool requeue)
+{
+    runtime_.complete(channel_, delivery_tag_,
+                      ConsumerRuntime::reject_completion, requeue);
+}
+
+ConsumerRuntime::ConsumerRuntime(AmqpEventLoop& loop, AmqpConnection& conn,
+                                 size_t workers,
+                                 const DeliveryHandler& handler):
+    loop_(loop),
+    conn_(conn),
+    handler_(handler),
+    completions_(1024),
+    workers_(new WorkStealingPool<Delivery*>(
+                 workers, boost::bind(&ConsumerRuntime::run, this, _1)))
+{
+    processor_.metrics(conn.metrics());
+}
+
+ConsumerRuntime::~ConsumerRuntime()
+{
+    loop_.remove(conn_);
+    loop_.idle_handler(boost::function<void ()>());
+
+    // finish the handlers still queued, then send what they completed
+    workers_.reset();
+    try
+    {
+        on_idle();
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Flushing acks: " << e.what() << std::endl;
+    }
+
+    for(size_t i = 0; i < channels_.size(); ++i)
+        delete channels_[i];
+}
+
+void ConsumerRuntime::attach(AmqpChannel& channel, size_t max_ack_batch)
+{
+    const amqp_channel_t id = channel.id();
+    if(id >= channels_.size())
+        channels_.resize(id + 1);
+
+    delete channels_[id];
+    channels_[id] = new ChannelState(channel, bodies_, max_ack_batch);
+}
+
+void ConsumerRuntime::start()
+{
+    loop_.idle_handler(boost::bind(&ConsumerRuntime::on_idle, this));
+    loop_.add(conn_, boost::bind(&ConsumerRuntime::on_frame, this, _1));
+}
+
+void ConsumerRuntime::on_frame(const amqp_frame_t& frame)
+{
+    if(frame.channel >= channels_.size() || channels_[frame.channel] == 0)
+        return;
+
+    AmqpVisitor& visitor = channels_[frame.channel]->visitor;
+    AmqpProcessor::Result result = processor_.process_frame(frame);
+
+    if(boost::apply_visitor(visitor, result))
+    {
+        if(ConnectionMetrics* metrics = conn_.metrics())
+        {
+            if(ChannelMetrics* channel = metrics->channel(frame.channel))
+                channel->delivered(visitor.delivery_tag(),
+                                   visitor.body_size(), visitor.properties());
+        }
+        workers_->post(new Delivery(*this, frame.channel, visitor));
+        visitor.reset();
+    }
+}
+
+void ConsumerRuntime::run(Delivery* delivery)
+{
+    handler_(*delivery);
+    delete delivery;
+}
+
+void ConsumerRuntime::complete(amqp_channel_t channel, uint64_t delivery_tag,
+                               CompletionKind kind, bool requeue)
+{
+    Completion completion;
+    completion.delivery_tag = delivery_tag;
+    completion.channel = channel;
+    completion.kind = kind;
+    completion.requeue = requeue;
+
+    completions_.push(completion);
+    loop_.wake();
+}
+
+void ConsumerRuntime::on_idle()
+{
+    Completion completion;
+    while(completions_.pop(completion))
+    {
+        AckAccumulator& acks = channels_[completion.channel]->acks;
+        switch(completion.kind)
+        {
+        case ack_completion:
+            acks.complete(completion.delivery_tag);
+            break;
+
+        case nack_completion:
+            acks.nack(completion.delivery_tag, completion.requeue);
+            break;
+
+        case reject_completion:
+            acks.reject(completion.delivery_tag, completion.requeue);
+            break;
+        }
+    }
+
+    for(size_t i = 0; i < channels_.size(); ++i)
+    {
+        if(channels_[i] != 0)
+            channels_[i]->acks.poll();
+    }
+}
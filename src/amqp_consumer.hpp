@@ -0,0 +1,129 @@
+#ifndef AMQP_CONSUMER_HPP
+#define AMQP_CONSUMER_HPP
+
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lockfree/queue.hpp>
+#include "amqp_ack.hpp"
+#include "amqp_arena.hpp"
+#include "amqp_event_loop.hpp"
+#include "amqp_process.hpp"
+#include "amqp_visitor.hpp"
+#include "amqp_worker_pool.hpp"
+
+class ConsumerRuntime;
+
+// A fully assembled message handed to a worker thread. Its properties and
+// body are owned, so it does not depend on the connection's frame buffers.
+// ack(), nack() and reject() may be called from the worker; they are
+// carried out later on the I/O thread.
+class Delivery: boost::noncopyable
+{
+public:
+    amqp_channel_t channel() const
+    {
+        return channel_;
+    }
+
+    uint64_t delivery_tag() const
+    {
+        return delivery_tag_;
+    }
+
+    const amqp_basic_properties_t& properties() const
+    {
+        return properties_.data();
+    }
+
+    const BodyBufferPtr& body() const
+    {
+        return body_;
+    }
+
+    void ack();
+    void nack(bool requeue = true);
+    void reject(bool requeue = true);
+
+private:
+    friend class ConsumerRuntime;
+
+    Delivery(ConsumerRuntime& runtime, amqp_channel_t channel,
+             const AmqpVisitor& visitor);
+
+    ConsumerRuntime& runtime_;
+    const amqp_channel_t channel_;
+    const uint64_t delivery_tag_;
+    AmqpArenaProperties properties_;
+    BodyBufferPtr body_;
+};
+
+typedef boost::function<void (Delivery&)> DeliveryHandler;
+
+// Splits consuming between one I/O thread and a pool of workers. The I/O
+// thread runs the event loop, assembles deliveries and posts them to a
+// work-stealing pool. Workers post their acknowledgements to a lock-free
+// queue that the I/O thread drains after every loop iteration into
+// per-channel AckAccumulators, so parallel handlers still ack in bulk.
+//
+// Channels are attached after their consumers are started; start() then
+// adds the connection to the loop. The runtime owns the loop's idle
+// handler while it exists; run the loop with a timeout no longer than the
+// ack delay so time-based ack flushes happen on an idle connection.
+class ConsumerRuntime: boost::noncopyable
+{
+public:
+    ConsumerRuntime(AmqpEventLoop& loop, AmqpConnection& conn,
+                    size_t workers, const DeliveryHandler& handler);
+
+    void attach(AmqpChannel& channel, size_t max_ack_batch = 64);
+    void start();
+
+    ~ConsumerRuntime();
+
+private:
+    friend class Delivery;
+
+    enum CompletionKind
+    {
+        ack_completion,
+        nack_completion,
+        reject_completion
+    };
+
+    struct Completion
+    {
+        uint64_t delivery_tag;
+        amqp_channel_t channel;
+        uint8_t kind;
+        bool requeue;
+    };
+
+    struct ChannelState
+    {
+        ChannelState(AmqpChannel& channel, BodyBufferPool& pool,
+                     size_t max_ack_batch):
+            visitor(pool),
+            acks(channel, max_ack_batch)
+        {}
+
+        AmqpVisitor visitor;
+        AckAccumulator acks;
+    };
+
+    void complete(amqp_channel_t channel, uint64_t delivery_tag,
+                  CompletionKind kind, bool requeue);
+    void on_frame(const amqp_frame_t& frame);
+    void on_idle();
+    void run(Delivery* delivery);
+
+    AmqpEventLoop& loop_;
+    AmqpConnection& conn_;
+    const DeliveryHandler handler_;
+    AmqpProcessor processor_;
+    BodyBufferPool bodies_;
+    std::vector<ChannelState*> channels_;
+    boost::lockfree::queue<Completion> completions_;
+    boost::scoped_ptr<WorkStealingPool<Delivery*> > workers_;
+};
+
+#endif // AMQP_CONSUMER_HPP
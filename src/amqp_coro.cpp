@@ -0,0 +1,453 @@
+#include "amqp_coro.hpp"
+
+#ifdef AMQP_HAS_COROUTINES
+
+#include <vector>
+#include <boost/bind.hpp>
+
+namespace
+{
+    struct Detached
+    {
+        struct promise_type
+        {
+            Detached get_return_object()
+            {
+                return Detached();
+            }
+
+            std::suspend_never initial_suspend() noexcept
+            {
+                return {};
+            }
+
+            std::suspend_never final_suspend() noexcept
+            {
+                return {};
+            }
+
+            void return_void()
+            {}
+
+            void unhandled_exception()
+            {
+                std::terminate();
+            }
+        };
+    };
+
+    Detached run_detached(Task<void> task, TaskErrorHandler on_error)
+    {
+        try
+        {
+            co_await task;
+        }
+        catch(...)
+        {
+            if(!on_error)
+                std::terminate();
+            on_error(std::current_exception());
+        }
+    }
+
+    inline const void* decoded(const amqp_frame_t& frame)
+    {
+        return frame.payload.method.decoded;
+    }
+
+    inline void resume(std::vector<std::coroutine_handle<> >& handles)
+    {
+        for(size_t i = 0; i < handles.size(); ++i)
+            handles[i].resume();
+    }
+}
+
+void spawn(Task<void> task, TaskErrorHandler on_error)
+{
+    run_detached(std::move(task), std::move(on_error));
+}
+
+class AsyncChannel::ReplyAwaiter
+{
+public:
+    ReplyAwaiter(AsyncChannel& channel, amqp_method_number_t reply):
+        channel_(channel)
+    {
+        waiter_.reply = reply;
+        waiter_.frame = 0;
+    }
+
+    bool await_ready() const
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        waiter_.handle = handle;
+        channel_.rpc_waiters_.push_back(&waiter_);
+    }
+
+    // valid until the awaiting coroutine suspends again
+    const amqp_frame_t& await_resume()
+    {
+        if(waiter_.error)
+            std::rethrow_exception(waiter_.error);
+        return *waiter_.frame;
+    }
+
+private:
+    AsyncChannel& channel_;
+    RpcWaiter waiter_;
+};
+
+class AsyncChannel::ConfirmAwaiter
+{
+public:
+    ConfirmAwaiter(AsyncChannel& channel, uint64_t tag):
+        channel_(channel)
+    {
+        waiter_.tag = tag;
+        waiter_.acked = false;
+        waiter_.done = false;
+    }
+
+    bool await_ready() const
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        waiter_.handle = handle;
+        channel_.confirm_waiters_.push_back(&waiter_);
+    }
+
+    bool await_resume()
+    {
+        if(waiter_.error)
+            std::rethrow_exception(waiter_.error);
+        return waiter_.acked;
+    }
+
+private:
+    AsyncChannel& channel_;
+    ConfirmWaiter waiter_;
+};
+
+AsyncChannel::AsyncChannel(AmqpEventLoop& loop, AmqpChannel& channel,
+                           BodyBufferPool& pool):
+    loop_(loop),
+    channel_(channel),
+    visitor_(pool),
+    encoder_(channel.connection().frame_max()),
+    redelivered_(false),
+    returning_(false),
+    return_remaining_(0),
+    confirming_(false),
+    next_publish_tag_(1)
+{
+    encoder_.metrics(channel.connection().metrics());
+    processor_.metrics(channel.connection().metrics());
+    loop_.handle(channel_.connection(), channel_.id(),
+                 boost::bind(&AsyncChannel::on_frame, this, _1));
+}
+
+AsyncChannel::~AsyncChannel()
+{
+    loop_.handle(channel_.connection(), channel_.id(), FrameHandler());
+}
+
+void AsyncChannel::send_method(amqp_method_number_t id, void* method)
+{
+    if(closed_)
+        std::rethrow_exception(closed_);
+
+    encoder_.method(channel_.id(), id, method);
+    const int rc = encoder_.send(channel_.connection());
+    check("Sending method", rc);
+}
+
+AsyncChannel::ReplyAwaiter AsyncChannel::call(amqp_method_number_t id,
+                                              void* method,
+                                              amqp_method_number_t reply)
+{
+    send_method(id, method);
+    return ReplyAwaiter(*this, reply);
+}
+
+Task<QueueDeclareResult> AsyncChannel::queue_declare(QueueData data)
+{
+    amqp_queue_declare_t method;
+    method.ticket = 0;
+    method.queue = data.queue;
+    method.passive = data.passive;
+    method.durable = data.durable;
+    method.exclusive = data.exclusive;
+    method.auto_delete = data.auto_delete;
+    method.nowait = 0;
+    method.arguments = data.arguments;
+
+    const amqp_frame_t& reply = co_await call(AMQP_QUEUE_DECLARE_METHOD,
+                                              &method,
+                                              AMQP_QUEUE_DECLARE_OK_METHOD);
+    const amqp_queue_declare_ok_t* ok =
+            static_cast<const amqp_queue_declare_ok_t*>(decoded(reply));
+
+    QueueDeclareResult result;
+    result.queue = from_amqp_bytes<std::string>(ok->queue);
+    result.message_count = ok->message_count;
+    result.consumer_count = ok->consumer_count;
+    co_return result;
+}
+
+Task<void> AsyncChannel::qos(QosData data)
+{
+    amqp_basic_qos_t method;
+    method.prefetch_size = data.prefetch_size;
+    method.prefetch_count = data.prefetch_count;
+    method.global = data.global;
+
+    co_await call(AMQP_BASIC_QOS_METHOD, &method, AMQP_BASIC_QOS_OK_METHOD);
+}
+
+Task<std::string> AsyncChannel::consume(ConsumeData data)
+{
+    amqp_basic_consume_t method;
+    method.ticket = 0;
+    method.queue = data.queue;
+    method.consumer_tag = data.consumer_tag;
+    method.no_local = data.no_local;
+    method.no_ack = data.no_ack;
+    method.exclusive = data.exclusive;
+    method.nowait = 0;
+    method.arguments = data.arguments;
+
+    const amqp_frame_t& reply = co_await call(AMQP_BASIC_CONSUME_METHOD,
+                                              &method,
+                                              AMQP_BASIC_CONSUME_OK_METHOD);
+    const amqp_basic_consume_ok_t* ok =
+            static_cast<const amqp_basic_consume_ok_t*>(decoded(reply));
+    co_return from_amqp_bytes<std::string>(ok->consumer_tag);
+}
+
+Task<void> AsyncChannel::confirm_select()
+{
+    amqp_confirm_select_t method;
+    method.nowait = 0;
+
+    ReplyAwaiter reply = call(AMQP_CONFIRM_SELECT_METHOD, &method,
+                              AMQP_CONFIRM_SELECT_OK_METHOD);
+    // the broker numbers every publish it reads after the select, so
+    // publishes sent while waiting for select-ok are already counted
+    confirming_ = true;
+    co_await reply;
+}
+
+Task<bool> AsyncChannel::publish_confirmed(PublishData& data)
+{
+    if(!confirming_)
+        co_await confirm_select();
+
+    const uint64_t tag = next_publish_tag_;
+    publish(data);
+    co_return co_await ConfirmAwaiter(*this, tag);
+}
+
+void AsyncChannel::publish(PublishData& data)
+{
+    if(closed_)
+        std::rethrow_exception(closed_);
+
+    amqp_basic_publish_t method;
+    method.ticket = 0;
+    method.exchange = data.exchange;
+    method.routing_key = data.routing_key;
+    method.mandatory = data.mandatory;
+    method.immediate = data.immediate;
+
+    const amqp_basic_properties_t properties = data.message.properties;
+    const amqp_bytes_t& body = data.message.body;
+    const amqp_channel_t channel = channel_.id();
+
+    encoder_.method(channel, AMQP_BASIC_PUBLISH_METHOD, &method);
+    encoder_.header(channel, body.len, properties);
+    encoder_.body(channel, body);
+    const int rc = encoder_.send(channel_.connection());
+    check("Publishing", rc);
+
+    if(confirming_)
+        ++next_publish_tag_;
+}
+
+void AsyncChannel::ack(uint64_t delivery_tag, bool multiple)
+{
+    channel_.ack(delivery_tag, multiple);
+}
+
+void AsyncChannel::reject(uint64_t delivery_tag, bool requeue)
+{
+    channel_.reject(delivery_tag, requeue);
+}
+
+void AsyncChannel::on_frame(const amqp_frame_t& frame)
+{
+    if(returning_ && frame.frame_type != AMQP_FRAME_METHOD)
+        return skip_returned(frame);
+
+    if(frame.frame_type == AMQP_FRAME_METHOD)
+    {
+        const amqp_method_number_t id = frame.payload.method.id;
+        switch(id)
+        {
+        case AMQP_BASIC_DELIVER_METHOD:
+            {
+                const amqp_basic_deliver_t* deliver =
+                        static_cast<const amqp_basic_deliver_t*>(
+                            decoded(frame));
+                exchange_ = from_amqp_bytes<std::string>(deliver->exchange);
+                routing_key_ =
+                        from_amqp_bytes<std::string>(deliver->routing_key);
+                redelivered_ = deliver->redelivered != 0;
+            }
+            break;
+
+        case AMQP_BASIC_ACK_METHOD:
+            {
+                const amqp_basic_ack_t* ack =
+                        static_cast<const amqp_basic_ack_t*>(decoded(frame));
+                on_confirm(ack->delivery_tag, ack->multiple, true);
+            }
+            return;
+
+        case AMQP_BASIC_NACK_METHOD:
+            {
+                const amqp_basic_nack_t* nack =
+                        static_cast<const amqp_basic_nack_t*>(decoded(frame));
+                on_confirm(nack->delivery_tag, nack->multiple, false);
+            }
+            return;
+
+        case AMQP_BASIC_RETURN_METHOD:
+            // a header and body frames follow, which are not a delivery
+            returning_ = true;
+            return;
+
+        case AMQP_CHANNEL_CLOSE_METHOD:
+            on_close(frame);
+            return;
+
+        default:
+            // replies come back in request order on a channel
+            if(!rpc_waiters_.empty() && rpc_waiters_.front()->reply == id)
+            {
+                RpcWaiter* waiter = rpc_waiters_.front();
+                rpc_waiters_.pop_front();
+                waiter->frame = &frame;
+                waiter->handle.resume();
+            }
+            return;
+        }
+    }
+
+    AmqpProcessor::Result result = processor_.process_frame(frame);
+    if(boost::apply_visitor(visitor_, result))
+        on_delivery();
+}
+
+void AsyncChannel::skip_returned(const amqp_frame_t& frame)
+{
+    if(frame.frame_type == AMQP_FRAME_HEADER)
+        return_remaining_ = frame.payload.properties.body_size;
+    else if(frame.frame_type == AMQP_FRAME_BODY)
+        return_remaining_ -= frame.payload.body_fragment.len;
+    returning_ = return_remaining_ > 0;
+}
+
+void AsyncChannel::on_delivery()
+{
+    AsyncMessagePtr message(new AsyncMessage);
+    message->channel = channel_.id();
+    message->delivery_tag = visitor_.delivery_tag();
+    message->redelivered = redelivered_;
+    message->exchange.swap(exchange_);
+    message->routing_key.swap(routing_key_);
+    message->properties.assign(*visitor_.properties());
+    message->body = visitor_.body_buffer();
+    visitor_.reset();
+
+    if(message_waiters_.empty())
+    {
+        messages_.push_back(std::move(message));
+        return;
+    }
+
+    MessageWaiter* waiter = message_waiters_.front();
+    message_waiters_.pop_front();
+    waiter->message = std::move(message);
+    waiter->handle.resume();
+}
+
+void AsyncChannel::on_confirm(uint64_t tag, bool multiple, bool acked)
+{
+    // tag 0 with multiple set confirms everything outstanding
+    const bool all = multiple && tag == 0;
+
+    std::vector<std::coroutine_handle<> > ready;
+    std::deque<ConfirmWaiter*> waiting;
+    for(size_t i = 0; i < confirm_waiters_.size(); ++i)
+    {
+        ConfirmWaiter* waiter = confirm_waiters_[i];
+        const bool matches = all || waiter->tag == tag ||
+                (multiple && waiter->tag < tag);
+        if(!matches)
+        {
+            waiting.push_back(waiter);
+            continue;
+        }
+
+        waiter->acked = acked;
+        waiter->done = true;
+        ready.push_back(waiter->handle);
+    }
+
+    // resumed coroutines may start waiting again
+    confirm_waiters_.swap(waiting);
+    resume(ready);
+}
+
+void AsyncChannel::on_close(const amqp_frame_t& frame)
+{
+    amqp_rpc_reply_t reply = amqp_rpc_reply_t();
+    reply.reply_type = AMQP_RESPONSE_SERVER_EXCEPTION;
+    reply.reply = frame.payload.method;
+    closed_ = std::make_exception_ptr(AmqpRpcError("Channel closed", reply));
+
+    amqp_channel_close_ok_t close_ok;
+    encoder_.method(channel_.id(), AMQP_CHANNEL_CLOSE_OK_METHOD, &close_ok);
+    check("Closing channel", encoder_.send(channel_.connection()),
+          true);
+
+    std::vector<std::coroutine_handle<> > ready;
+    for(size_t i = 0; i < rpc_waiters_.size(); ++i)
+    {
+        rpc_waiters_[i]->error = closed_;
+        ready.push_back(rpc_waiters_[i]->handle);
+    }
+    for(size_t i = 0; i < confirm_waiters_.size(); ++i)
+    {
+        confirm_waiters_[i]->error = closed_;
+        ready.push_back(confirm_waiters_[i]->handle);
+    }
+    for(size_t i = 0; i < message_waiters_.size(); ++i)
+    {
+        message_waiters_[i]->error = closed_;
+        ready.push_back(message_waiters_[i]->handle);
+    }
+    rpc_waiters_.clear();
+    confirm_waiters_.clear();
+    message_waiters_.clear();
+    resume(ready);
+}
+
+#endif // AMQP_HAS_COROUTINES
@@ -0,0 +1,334 @@
+#ifndef AMQP_CORO_HPP
+#define AMQP_CORO_HPP
+
+// C++20 coroutine API over AmqpEventLoop; empty unless the compiler
+// supports coroutines (e.g. g++ -std=c++20).
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define AMQP_HAS_COROUTINES 1
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include "amqp_arena.hpp"
+#include "amqp_channel.hpp"
+#include "amqp_encoder.hpp"
+#include "amqp_event_loop.hpp"
+#include "amqp_process.hpp"
+#include "amqp_visitor.hpp"
+
+template<typename T> class Task;
+
+namespace detail
+{
+    struct TaskPromiseBase
+    {
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            template<typename P>
+            std::coroutine_handle<> await_suspend(
+                    std::coroutine_handle<P> handle) noexcept
+            {
+                std::coroutine_handle<> next = handle.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept
+            {}
+        };
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void unhandled_exception()
+        {
+            error = std::current_exception();
+        }
+
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+    };
+
+    template<typename T>
+    struct TaskPromise: TaskPromiseBase
+    {
+        Task<T> get_return_object();
+
+        template<typename U> void return_value(U&& value)
+        {
+            result.emplace(std::forward<U>(value));
+        }
+
+        T take()
+        {
+            if(error)
+                std::rethrow_exception(error);
+            return std::move(*result);
+        }
+
+        std::optional<T> result;
+    };
+
+    template<>
+    struct TaskPromise<void>: TaskPromiseBase
+    {
+        Task<void> get_return_object();
+
+        void return_void()
+        {}
+
+        void take()
+        {
+            if(error)
+                std::rethrow_exception(error);
+        }
+    };
+}
+
+// Lazily started coroutine result. Awaiting the task starts it and
+// resumes the awaiter when it finishes; exceptions propagate to the
+// awaiter. Use spawn() to run a task nobody awaits.
+template<typename T = void>
+class Task
+{
+public:
+    typedef detail::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    explicit Task(Handle handle):
+        handle_(handle)
+    {}
+
+    Task(Task&& other) noexcept:
+        handle_(std::exchange(other.handle_, Handle()))
+    {}
+
+    Task(const Task&) = delete;
+    Task& operator = (const Task&) = delete;
+
+    ~Task()
+    {
+        if(handle_)
+            handle_.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter)
+    {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+
+    T await_resume()
+    {
+        return handle_.promise().take();
+    }
+
+private:
+    Handle handle_;
+};
+
+template<typename T>
+inline Task<T> detail::TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+typedef std::function<void (std::exception_ptr)> TaskErrorHandler;
+
+// Starts a task that is not awaited by anyone; it runs until its first
+// suspension right away and is destroyed when it finishes. An escaping
+// exception goes to on_error, or calls std::terminate() without one, as
+// for a std::thread.
+void spawn(Task<void> task, TaskErrorHandler on_error = TaskErrorHandler());
+
+// A delivery received by AsyncChannel::next_message(). It owns its
+// properties and body.
+struct AsyncMessage
+{
+    amqp_channel_t channel;
+    uint64_t delivery_tag;
+    bool redelivered;
+    std::string exchange;
+    std::string routing_key;
+    AmqpArenaProperties properties;
+    BodyBufferPtr body;
+};
+
+typedef std::unique_ptr<AsyncMessage> AsyncMessagePtr;
+
+struct QueueDeclareResult
+{
+    std::string queue;
+    uint32_t message_count;
+    uint32_t consumer_count;
+};
+
+// Awaitable operations on one channel of a connection driven by an
+// AmqpEventLoop. Requests are written at once (writes stay blocking, as
+// everywhere in the loop); the awaiting coroutine is resumed from the
+// loop thread when the reply frame arrives, so thousands of logical
+// consumers and callers can share the loop's thread. All calls must be
+// made on that thread.
+//
+// The connection must be in the loop before the channel is created, and
+// the channel must outlive every coroutine waiting on it. A channel.close
+// from the broker fails every waiting operation with AmqpRpcError.
+// Messages the broker returns (basic.return) are dropped.
+class AsyncChannel: boost::noncopyable
+{
+public:
+    AsyncChannel(AmqpEventLoop& loop, AmqpChannel& channel,
+                 BodyBufferPool& pool);
+
+    amqp_channel_t id() const
+    {
+        return channel_.id();
+    }
+
+    Task<QueueDeclareResult> queue_declare(QueueData data);
+    Task<void> qos(QosData data);
+    Task<std::string> consume(ConsumeData data);
+    Task<void> confirm_select();
+
+    // Resumes with the next delivery on this channel; waiters are served
+    // in the order they started waiting.
+    auto next_message()
+    {
+        return MessageAwaiter(*this);
+    }
+
+    // Puts the channel in confirm mode on first use; resumes with true
+    // once the broker acks the message, false if it nacks it.
+    Task<bool> publish_confirmed(PublishData& data);
+
+    void publish(PublishData& data);
+    void ack(uint64_t delivery_tag, bool multiple = false);
+    void reject(uint64_t delivery_tag, bool requeue = true);
+
+    ~AsyncChannel();
+
+private:
+    struct Waiter
+    {
+        std::coroutine_handle<> handle;
+        std::exception_ptr error;
+    };
+
+    struct RpcWaiter: Waiter
+    {
+        amqp_method_number_t reply;
+        const amqp_frame_t* frame;
+    };
+
+    struct ConfirmWaiter: Waiter
+    {
+        uint64_t tag;
+        bool acked;
+        bool done;
+    };
+
+    struct MessageWaiter: Waiter
+    {
+        AsyncMessagePtr message;
+    };
+
+    class MessageAwaiter
+    {
+    public:
+        explicit MessageAwaiter(AsyncChannel& channel):
+            channel_(channel)
+        {}
+
+        bool await_ready()
+        {
+            if(channel_.messages_.empty())
+                return false;
+            waiter_.message = std::move(channel_.messages_.front());
+            channel_.messages_.pop_front();
+            return true;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            waiter_.handle = handle;
+            channel_.message_waiters_.push_back(&waiter_);
+        }
+
+        AsyncMessagePtr await_resume()
+        {
+            if(waiter_.error)
+                std::rethrow_exception(waiter_.error);
+            return std::move(waiter_.message);
+        }
+
+    private:
+        AsyncChannel& channel_;
+        MessageWaiter waiter_;
+    };
+
+    class ReplyAwaiter;
+    class ConfirmAwaiter;
+
+    ReplyAwaiter call(amqp_method_number_t id, void* method,
+                      amqp_method_number_t reply);
+    void send_method(amqp_method_number_t id, void* method);
+
+    void on_frame(const amqp_frame_t& frame);
+    void skip_returned(const amqp_frame_t& frame);
+    void on_delivery();
+    void on_confirm(uint64_t tag, bool multiple, bool acked);
+    void on_close(const amqp_frame_t& frame);
+
+    AmqpEventLoop& loop_;
+    AmqpChannel& channel_;
+    AmqpProcessor processor_;
+    AmqpVisitor visitor_;
+    FrameEncoder encoder_;
+
+    // copied from basic.deliver, whose frame buffer may be gone by the
+    // time the body is complete
+    std::string exchange_;
+    std::string routing_key_;
+    bool redelivered_;
+
+    // the content of a basic.return is still to come
+    bool returning_;
+    uint64_t return_remaining_;
+
+    std::deque<AsyncMessagePtr> messages_;
+    std::deque<MessageWaiter*> message_waiters_;
+    std::deque<RpcWaiter*> rpc_waiters_;
+    std::deque<ConfirmWaiter*> confirm_waiters_;
+    bool confirming_;
+    uint64_t next_publish_tag_;
+    std::exception_ptr closed_;
+};
+
+#endif // coroutines
+#endif // AMQP_CORO_HPP
@@ -0,0 +1,173 @@
+#include "amqp_encoder.hpp"
+#include "amqp_connection.hpp"
+#include "amqp_metrics.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+
+namespace
+{
+    inline void check_encoded(const char* context, int rc)
+    {
+        if(rc < 0)
+            throw std::runtime_error(context);
+    }
+
+    inline uint32_t get_u32(const char* in)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+        return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 |
+                uint32_t(bytes[2]) << 8 | bytes[3];
+    }
+}
+
+FrameEncoder::FrameEncoder(size_t frame_max):
+    frame_max_(frame_max),
+    metrics_(),
+    buffer_(frame_max),
+    size_()
+{}
+
+void FrameEncoder::reserve(size_t size)
+{
+    const size_t needed = size_ + size;
+    if(needed > buffer_.size())
+        buffer_.resize(std::max(needed, 2 * buffer_.size()));
+}
+
+size_t FrameEncoder::begin_frame(uint8_t type, amqp_channel_t channel)
+{
+    reserve(frame_max_);
+    const size_t start = size_;
+    char* out = data() + start;
+    put_u8(out, type);
+    put_u16(out + 1, channel);
+    size_ += frame_header_size;
+    return start;
+}
+
+void FrameEncoder::end_frame(size_t start)
+{
+    const size_t payload = size_ - start - frame_header_size;
+    put_u32(data() + start + 3, static_cast<uint32_t>(payload));
+    put_u8(data() + size_, AMQP_FRAME_END);
+    size_ += frame_footer_size;
+}
+
+amqp_bytes_t FrameEncoder::tail(size_t start)
+{
+    // room left in the frame begun at start, keeping space for the footer
+    amqp_bytes_t result;
+    result.bytes = data() + size_;
+    result.len = start + frame_max_ - frame_footer_size - size_;
+    return result;
+}
+
+char* FrameEncoder::extend(size_t size)
+{
+    reserve(size);
+    char* out = data() + size_;
+    size_ += size;
+    return out;
+}
+
+void FrameEncoder::method(amqp_channel_t channel, amqp_method_number_t id,
+                          void* decoded)
+{
+    const size_t start = begin_frame(AMQP_FRAME_METHOD, channel);
+    put_u32(data() + size_, id);
+    size_ += 4;
+
+    const int rc = amqp_encode_method(id, decoded, tail(start));
+    check_encoded("Encoding method frame", rc);
+    size_ += rc;
+    end_frame(start);
+}
+
+void FrameEncoder::header(amqp_channel_t channel, uint64_t body_size,
+                          const amqp_basic_properties_t& properties)
+{
+    const size_t start = begin_frame(AMQP_FRAME_HEADER, channel);
+    char* out = data() + size_;
+    put_u16(out, AMQP_BASIC_CLASS);
+    put_u16(out + 2, 0); // weight
+    put_u64(out + 4, body_size);
+    size_ += 12;
+
+    void* decoded = const_cast<amqp_basic_properties_t*>(&properties);
+    const int rc =
+            amqp_encode_properties(AMQP_BASIC_CLASS, decoded, tail(start));
+    check_encoded("Encoding header frame", rc);
+    size_ += rc;
+    end_frame(start);
+}
+
+void FrameEncoder::body(amqp_channel_t channel, const amqp_bytes_t& body)
+{
+    const size_t max_fragment = frame_max_ - frame_overhead;
+    const char* bytes = static_cast<const char*>(body.bytes);
+
+    for(size_t offset = 0; offset < body.len; offset += max_fragment)
+    {
+        const size_t len = std::min(max_fragment, body.len - offset);
+        const size_t start = begin_frame(AMQP_FRAME_BODY, channel);
+        memcpy(data() + size_, bytes + offset, len);
+        size_ += len;
+        end_frame(start);
+    }
+}
+
+void FrameEncoder::count_sent() const
+{
+    if(metrics_ == 0)
+        return;
+
+    // the buffer holds whole frames only, including ones copied in
+    // through extend()
+    size_t offset = 0;
+    while(offset < size_)
+    {
+        const char* frame = data() + offset;
+        const size_t wire_size = get_u32(frame + 3) + frame_overhead;
+        metrics_->frame_out(frame[0], wire_size);
+        offset += wire_size;
+    }
+}
+
+int FrameEncoder::send(int sockfd)
+{
+    size_t sent = 0;
+    while(sent < size_)
+    {
+        const ssize_t rc = ::send(sockfd, data() + sent, size_ - sent,
+                                  MSG_NOSIGNAL);
+        if(rc < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            // a partly written frame leaves the connection unusable
+            clear();
+            return socket_error();
+        }
+        sent += rc;
+    }
+    count_sent();
+    clear();
+    return 0;
+}
+
+int FrameEncoder::send(AmqpConnection& conn)
+{
+    Transport* transport = conn.transport();
+    if(transport == 0)
+        return send(conn.sockfd());
+
+    const int rc = transport->send(data(), size_);
+    if(rc >= 0)
+        count_sent();
+    clear();
+    return rc;
+}
@@ -0,0 +1,101 @@
+#ifndef AMQP_ENCODER_HPP
+#define AMQP_ENCODER_HPP
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <amqp.h>
+
+class AmqpConnection;
+class ConnectionMetrics;
+
+// Encodes complete AMQP frames back to back into one growable buffer so
+// they can be written to the socket with a single call.
+class FrameEncoder: boost::noncopyable
+{
+public:
+    static const size_t frame_header_size = 7;
+    static const size_t frame_footer_size = 1;
+    static const size_t frame_overhead = frame_header_size + frame_footer_size;
+
+    explicit FrameEncoder(size_t frame_max = 131072);
+
+    size_t frame_max() const
+    {
+        return frame_max_;
+    }
+
+    void frame_max(size_t value)
+    {
+        frame_max_ = value;
+    }
+
+    // Counts the encoded frames once they are sent; null disables
+    // counting.
+    void metrics(ConnectionMetrics* metrics)
+    {
+        metrics_ = metrics;
+    }
+
+    ConnectionMetrics* metrics() const
+    {
+        return metrics_;
+    }
+
+    const char* data() const
+    {
+        return &buffer_[0];
+    }
+
+    char* data()
+    {
+        return &buffer_[0];
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    void clear()
+    {
+        size_ = 0;
+    }
+
+    // Appends size bytes for the caller to fill in.
+    char* extend(size_t size);
+
+    void method(amqp_channel_t channel, amqp_method_number_t id,
+                void* decoded);
+    void header(amqp_channel_t channel, uint64_t body_size,
+                const amqp_basic_properties_t& properties);
+    void body(amqp_channel_t channel, const amqp_bytes_t& body);
+
+    // Counts the buffered frames as sent. send() does this; callers that
+    // write data() themselves call it once the write succeeded.
+    void count_sent() const;
+
+    // Writes the whole buffer to the socket and clears it; returns a
+    // negative librabbitmq-style error code on failure.
+    int send(int sockfd);
+
+    // Same, through the connection's transport when it has one.
+    int send(AmqpConnection& conn);
+
+private:
+    void reserve(size_t size);
+    size_t begin_frame(uint8_t type, amqp_channel_t channel);
+    void end_frame(size_t start);
+    amqp_bytes_t tail(size_t start);
+
+    size_t frame_max_;
+    ConnectionMetrics* metrics_;
+    std::vector<char> buffer_;
+    size_t size_;
+};
+
+#endif // AMQP_ENCODER_HPP
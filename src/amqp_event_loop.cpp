@@ -0,0 +1,334 @@
+#include "amqp_event_loop.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/move/unique_ptr.hpp>
+#include "amqp_encoder.hpp"
+
+namespace
+{
+    const int max_events = 64;
+
+    inline int to_milliseconds(AmqpEventLoop::Clock::duration d)
+    {
+        using namespace boost::chrono;
+        return static_cast<int>(ceil<milliseconds>(d).count());
+    }
+}
+
+AmqpEventLoop::AmqpEventLoop(size_t read_buffer_size):
+    epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+    wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    buffer_(read_buffer_size),
+    stopped_(false)
+{
+    check_os("Creating epoll instance", epoll_fd_);
+    check_os("Creating wakeup event", wake_fd_);
+
+    // a null registration marks the wakeup event
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.ptr = 0;
+    const int rc = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+    check_os("Adding wakeup event to event loop", rc);
+}
+
+AmqpEventLoop::~AmqpEventLoop()
+{
+    for(Registrations::iterator it = connections_.begin();
+        it != connections_.end(); ++it)
+        delete it->second;
+    release_retired();
+    close(wake_fd_);
+    close(epoll_fd_);
+}
+
+void AmqpEventLoop::add(AmqpConnection& conn, const FrameHandler& handler,
+                        const ErrorHandler& on_error)
+{
+    if(connections_.count(&conn) > 0)
+        throw std::logic_error("connection is already in the event loop");
+
+    boost::movelib::unique_ptr<Registration> reg(new Registration(conn));
+    reg->fallback = handler;
+    reg->on_error = on_error;
+    reg->last_received = Clock::now();
+
+    const int heartbeat = conn.heartbeat();
+    if(heartbeat > 0)
+    {
+        reg->heartbeat = boost::chrono::seconds(heartbeat);
+        reg->next_heartbeat = reg->last_received + reg->heartbeat / 2;
+    }
+
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.ptr = reg.get();
+    const int rc = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, reg->fd, &event);
+    check_os("Adding connection to event loop", rc);
+
+    Registration& added = *reg;
+    connections_[&conn] = reg.release();
+
+    // frames librabbitmq already read or queued during setup RPCs never
+    // show up as socket readiness
+    drain_pending(added);
+}
+
+void AmqpEventLoop::remove(AmqpConnection& conn)
+{
+    Registrations::iterator it = connections_.find(&conn);
+    if(it == connections_.end())
+        return;
+
+    // deleted after the current batch; frames of it may still be on the
+    // call stack
+    Registration* reg = it->second;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, reg->fd, 0);
+    connections_.erase(it);
+    reg->removed = true;
+    retired_.push_back(reg);
+}
+
+void AmqpEventLoop::release_retired()
+{
+    for(size_t i = 0; i < retired_.size(); ++i)
+        delete retired_[i];
+    retired_.clear();
+}
+
+AmqpEventLoop::Registration& AmqpEventLoop::registration(AmqpConnection& conn)
+{
+    Registrations::iterator it = connections_.find(&conn);
+    if(it == connections_.end())
+        throw std::logic_error("connection is not in the event loop");
+    return *it->second;
+}
+
+void AmqpEventLoop::handle(AmqpConnection& conn, amqp_channel_t channel,
+                           const FrameHandler& handler)
+{
+    std::vector<FrameHandler>& channels = registration(conn).channels;
+    if(channel >= channels.size())
+        channels.resize(channel + 1);
+    channels[channel] = handler;
+}
+
+void AmqpEventLoop::auto_release(AmqpConnection& conn, bool enabled)
+{
+    registration(conn).release = enabled;
+}
+
+void AmqpEventLoop::drain_pending(Registration& reg)
+{
+    AmqpConnection& conn = reg.conn;
+    amqp_frame_t frame;
+
+    while(amqp_frames_enqueued(conn) || amqp_data_in_buffer(conn))
+    {
+        const int rc = conn.wait_frame(frame);
+        if(rc < 0)
+            return fail(reg, rc);
+
+        if(ConnectionMetrics* metrics = conn.metrics())
+            metrics->frame_in(frame);
+        dispatch(reg, frame);
+        if(reg.removed)
+            return;
+    }
+}
+
+void AmqpEventLoop::dispatch(Registration& reg, const amqp_frame_t& frame)
+{
+    if(frame.frame_type == AMQP_FRAME_HEARTBEAT)
+        return;
+
+    const std::vector<FrameHandler>& channels = reg.channels;
+    if(frame.channel < channels.size() && channels[frame.channel])
+        channels[frame.channel](frame);
+    else if(reg.fallback)
+        reg.fallback(frame);
+}
+
+void AmqpEventLoop::fail(Registration& reg, int rc)
+{
+    AmqpConnection& conn = reg.conn;
+    const ErrorHandler on_error = reg.on_error;
+    remove(conn);
+
+    if(on_error)
+        on_error(conn, rc);
+    else
+        check("Event loop", rc, true);
+}
+
+void AmqpEventLoop::read(Registration& reg)
+{
+    AmqpConnection& conn = reg.conn;
+
+    while(true)
+    {
+        const ssize_t received =
+                recv(reg.fd, &buffer_[0], buffer_.size(), MSG_DONTWAIT);
+
+        if(received < 0 && errno == EINTR)
+            continue;
+        if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(received <= 0)
+            return fail(reg, received == 0 ? connection_closed_error()
+                                           : socket_error());
+
+        reg.last_received = Clock::now();
+
+        amqp_bytes_t data;
+        data.bytes = &buffer_[0];
+        data.len = received;
+        frames_.clear();
+
+        while(data.len > 0)
+        {
+            amqp_frame_t frame;
+            const int rc = amqp_handle_input(conn, data, &frame);
+            if(rc < 0)
+                return fail(reg, rc);
+
+            data.bytes = static_cast<char*>(data.bytes) + rc;
+            data.len -= rc;
+            reg.frame_bytes += rc;
+
+            if(frame.frame_type != 0)
+            {
+                if(ConnectionMetrics* metrics = conn.metrics())
+                    metrics->frame_in(frame.frame_type, reg.frame_bytes);
+                reg.frame_bytes = 0;
+                frames_.push_back(frame);
+            }
+        }
+
+        for(size_t i = 0; i < frames_.size(); ++i)
+        {
+            dispatch(reg, frames_[i]);
+            if(reg.removed)
+                return;
+        }
+
+        // frames an RPC of a handler read past its reply
+        drain_pending(reg);
+        if(reg.removed)
+            return;
+
+        if(reg.release)
+            conn.release_buffers();
+
+        if(static_cast<size_t>(received) < buffer_.size())
+            break;
+    }
+}
+
+int AmqpEventLoop::next_timeout(int timeout_ms) const
+{
+    const Clock::time_point now = Clock::now();
+    int timeout = timeout_ms;
+
+    for(Registrations::const_iterator it = connections_.begin();
+        it != connections_.end(); ++it)
+    {
+        const Registration& reg = *it->second;
+        if(reg.heartbeat == Clock::duration::zero())
+            continue;
+
+        const int due = std::max(0, to_milliseconds(reg.next_heartbeat - now));
+        timeout = timeout < 0 ? due : std::min(timeout, due);
+    }
+    return timeout;
+}
+
+void AmqpEventLoop::run_timers()
+{
+    const Clock::time_point now = Clock::now();
+    std::vector<Registration*> expired;
+
+    for(Registrations::iterator it = connections_.begin();
+        it != connections_.end(); ++it)
+    {
+        Registration& reg = *it->second;
+        if(reg.heartbeat == Clock::duration::zero())
+            continue;
+
+        if(now - reg.last_received > 2 * reg.heartbeat)
+        {
+            expired.push_back(&reg);
+            continue;
+        }
+
+        if(now >= reg.next_heartbeat)
+        {
+            amqp_frame_t frame = amqp_frame_t();
+            frame.frame_type = AMQP_FRAME_HEARTBEAT;
+            frame.channel = 0;
+
+            const int rc = amqp_send_frame(reg.conn, &frame);
+            if(rc < 0)
+                expired.push_back(&reg);
+            else
+            {
+                reg.next_heartbeat = now + reg.heartbeat / 2;
+                if(ConnectionMetrics* metrics = reg.conn.metrics())
+                    metrics->frame_out(AMQP_FRAME_HEARTBEAT,
+                                       FrameEncoder::frame_overhead);
+            }
+        }
+    }
+
+    for(size_t i = 0; i < expired.size(); ++i)
+        fail(*expired[i], os_error(ETIMEDOUT));
+}
+
+void AmqpEventLoop::run_once(int timeout_ms)
+{
+    epoll_event events[max_events];
+    const int count = epoll_wait(epoll_fd_, events, max_events,
+                                 next_timeout(timeout_ms));
+    if(count < 0 && errno != EINTR)
+        check_os("Waiting for events", count);
+
+    for(int i = 0; i < count; ++i)
+    {
+        Registration* reg = static_cast<Registration*>(events[i].data.ptr);
+        if(reg == 0)
+        {
+            eventfd_t value;
+            eventfd_read(wake_fd_, &value);
+        }
+        else if(!reg->removed)
+            read(*reg);
+    }
+
+    run_timers();
+    release_retired();
+
+    if(idle_)
+        idle_();
+}
+
+void AmqpEventLoop::wake()
+{
+    eventfd_write(wake_fd_, 1);
+}
+
+void AmqpEventLoop::run()
+{
+    stopped_ = false;
+    while(!stopped_ && !connections_.empty())
+        run_once();
+}
+
+void AmqpEventLoop::stop()
+{
+    stopped_ = true;
+}
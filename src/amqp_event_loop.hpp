@@ -0,0 +1,117 @@
+#ifndef AMQP_EVENT_LOOP_HPP
+#define AMQP_EVENT_LOOP_HPP
+
+#include <map>
+#include <vector>
+#include <boost/chrono.hpp>
+#include "amqp_connection.hpp"
+
+typedef boost::function<void (AmqpConnection&, int rc)> ErrorHandler;
+
+// Drives many connections from one thread with epoll. Sockets are read
+// with MSG_DONTWAIT and whatever arrived is decoded with amqp_handle_input;
+// each frame goes to the handler registered for its channel, or to the
+// connection's default handler. Writes (acks, publishes) stay blocking.
+//
+// Everything received is decoded before the first handler runs, so
+// handlers may make synchronous RPCs (qos, queue_declare, closing a
+// channel): librabbitmq then reads the socket where the loop stopped, and
+// frames it reads past the reply are dispatched after the batch. Handlers
+// must not release the connection's buffers while the batch is being
+// dispatched, which rules out ConfirmTracker waits.
+//
+// Connections must be fully set up (channels opened, consumers started)
+// before they are added. The heartbeat interval is the one the connection
+// proposed, which is nonzero only for connections opened with
+// ConnectionOptions::heartbeat_driven; any other interval would expire
+// idle connections whose broker sends no heartbeats. Heartbeat frames are
+// sent every interval / 2 and a connection silent for two intervals is
+// reported to the error handler and removed.
+class AmqpEventLoop: boost::noncopyable
+{
+public:
+    typedef boost::chrono::steady_clock Clock;
+
+    explicit AmqpEventLoop(size_t read_buffer_size = 1 << 17);
+
+    void add(AmqpConnection& conn, const FrameHandler& handler,
+             const ErrorHandler& on_error = ErrorHandler());
+    void remove(AmqpConnection& conn);
+
+    void handle(AmqpConnection& conn, amqp_channel_t channel,
+                const FrameHandler& handler);
+
+    // When enabled (the default) frame buffers are released after each
+    // read; disable it when handlers keep zero-copy body views across
+    // reads and call AmqpConnection::release_buffers() themselves.
+    void auto_release(AmqpConnection& conn, bool enabled);
+
+    // Called on the loop thread after every iteration, e.g. to drain work
+    // posted by other threads.
+    void idle_handler(const boost::function<void ()>& handler)
+    {
+        idle_ = handler;
+    }
+
+    // Interrupts a waiting run_once(); safe to call from any thread.
+    void wake();
+
+    // Waits up to timeout_ms (-1 for no limit) and processes what is ready.
+    void run_once(int timeout_ms = -1);
+    void run();
+    void stop();
+
+    size_t size() const
+    {
+        return connections_.size();
+    }
+
+    ~AmqpEventLoop();
+
+private:
+    struct Registration
+    {
+        explicit Registration(AmqpConnection& c):
+            conn(c),
+            fd(c.sockfd()),
+            heartbeat(),
+            frame_bytes(),
+            release(true),
+            removed(false)
+        {}
+
+        AmqpConnection& conn;
+        const int fd;
+        FrameHandler fallback;
+        ErrorHandler on_error;
+        std::vector<FrameHandler> channels;
+        Clock::duration heartbeat;
+        Clock::time_point next_heartbeat;
+        Clock::time_point last_received;
+        size_t frame_bytes; // input consumed by the frame being decoded
+        bool release;
+        bool removed;
+    };
+
+    typedef std::map<AmqpConnection*, Registration*> Registrations;
+
+    Registration& registration(AmqpConnection& conn);
+    void drain_pending(Registration& reg);
+    void read(Registration& reg);
+    void dispatch(Registration& reg, const amqp_frame_t& frame);
+    void fail(Registration& reg, int rc);
+    int next_timeout(int timeout_ms) const;
+    void run_timers();
+    void release_retired();
+
+    const int epoll_fd_;
+    const int wake_fd_;
+    boost::function<void ()> idle_;
+    std::vector<char> buffer_;
+    std::vector<amqp_frame_t> frames_; // decoded from buffer_
+    Registrations connections_;
+    std::vector<Registration*> retired_;
+    bool stopped_;
+};
+
+#endif // AMQP_EVENT_LOOP_HPP
@@ -0,0 +1,401 @@
+#include "amqp_filter.hpp"
+#include <cstring>
+#include <stdexcept>
+#include "amqp_table_view.hpp"
+
+namespace
+{
+    // '*' matches any run of bytes, '?' one byte; on a mismatch the scan
+    // resumes one byte past where the last '*' started matching
+    bool glob_match(const char* pattern, size_t pattern_len,
+                    const char* text, size_t text_len)
+    {
+        size_t p = 0;
+        size_t t = 0;
+        size_t star = std::string::npos;
+        size_t resume = 0;
+
+        while(t < text_len)
+        {
+            if(p < pattern_len && (pattern[p] == '?' || pattern[p] == text[t]))
+            {
+                ++p;
+                ++t;
+            }
+            else if(p < pattern_len && pattern[p] == '*')
+            {
+                star = p++;
+                resume = t;
+            }
+            else if(star != std::string::npos)
+            {
+                p = star + 1;
+                t = ++resume;
+            }
+            else
+                return false;
+        }
+
+        while(p < pattern_len && pattern[p] == '*')
+            ++p;
+        return p == pattern_len;
+    }
+
+    inline bool compare(int64_t lhs, MessageFilter::Compare op, int64_t rhs)
+    {
+        switch(op)
+        {
+        case MessageFilter::equal:
+            return lhs == rhs;
+
+        case MessageFilter::not_equal:
+            return lhs != rhs;
+
+        case MessageFilter::less:
+            return lhs < rhs;
+
+        case MessageFilter::less_equal:
+            return lhs <= rhs;
+
+        case MessageFilter::greater:
+            return lhs > rhs;
+
+        case MessageFilter::greater_equal:
+            return lhs >= rhs;
+        }
+        return false;
+    }
+
+    const amqp_bytes_t* string_property(const amqp_basic_properties_t& props,
+                                        amqp_flags_t field)
+    {
+        switch(field)
+        {
+        case AMQP_BASIC_CONTENT_TYPE_FLAG:
+            return &props.content_type;
+
+        case AMQP_BASIC_CONTENT_ENCODING_FLAG:
+            return &props.content_encoding;
+
+        case AMQP_BASIC_CORRELATION_ID_FLAG:
+            return &props.correlation_id;
+
+        case AMQP_BASIC_REPLY_TO_FLAG:
+            return &props.reply_to;
+
+        case AMQP_BASIC_EXPIRATION_FLAG:
+            return &props.expiration;
+
+        case AMQP_BASIC_MESSAGE_ID_FLAG:
+            return &props.message_id;
+
+        case AMQP_BASIC_TYPE_FLAG:
+            return &props.type;
+
+        case AMQP_BASIC_USER_ID_FLAG:
+            return &props.user_id;
+
+        case AMQP_BASIC_APP_ID_FLAG:
+            return &props.app_id;
+
+        case AMQP_BASIC_CLUSTER_ID_FLAG:
+            return &props.cluster_id;
+
+        default:
+            return 0;
+        }
+    }
+
+    int64_t numeric_property(const amqp_basic_properties_t& props,
+                             amqp_flags_t field)
+    {
+        switch(field)
+        {
+        case AMQP_BASIC_DELIVERY_MODE_FLAG:
+            return props.delivery_mode;
+
+        case AMQP_BASIC_PRIORITY_FLAG:
+            return props.priority;
+
+        default:
+            return static_cast<int64_t>(props.timestamp);
+        }
+    }
+
+    inline bool is_numeric_property(amqp_flags_t field)
+    {
+        return field == AMQP_BASIC_DELIVERY_MODE_FLAG ||
+                field == AMQP_BASIC_PRIORITY_FLAG ||
+                field == AMQP_BASIC_TIMESTAMP_FLAG;
+    }
+}
+
+AmqpPattern::AmqpPattern(const std::string& pattern):
+    kind_(exact),
+    text_(pattern)
+{
+    const size_t wildcard = pattern.find_first_of("*?");
+    if(wildcard == std::string::npos)
+        return;
+
+    if(wildcard + 1 == pattern.size() && pattern[wildcard] == '*')
+    {
+        kind_ = prefix;
+        text_.erase(wildcard);
+    }
+    else
+        kind_ = glob;
+}
+
+bool AmqpPattern::match(const amqp_bytes_t& value) const
+{
+    const char* bytes = static_cast<const char*>(value.bytes);
+    switch(kind_)
+    {
+    case exact:
+        return value.len == text_.size() &&
+                memcmp(bytes, text_.data(), value.len) == 0;
+
+    case prefix:
+        return value.len >= text_.size() &&
+                memcmp(bytes, text_.data(), text_.size()) == 0;
+
+    case glob:
+        return glob_match(text_.data(), text_.size(), bytes, value.len);
+    }
+    return false;
+}
+
+MessageFilter& MessageFilter::routing_key(const std::string& pattern)
+{
+    deliver_predicates_.push_back(
+                Predicate(routing_key_source, matches, pattern));
+    return *this;
+}
+
+MessageFilter& MessageFilter::exchange(const std::string& pattern)
+{
+    deliver_predicates_.push_back(
+                Predicate(exchange_source, matches, pattern));
+    return *this;
+}
+
+MessageFilter& MessageFilter::property(amqp_flags_t field,
+                                       const std::string& pattern)
+{
+    if(is_numeric_property(field) || field == AMQP_BASIC_HEADERS_FLAG)
+        throw std::invalid_argument("not a short string property");
+
+    Predicate predicate(property_source, matches, pattern);
+    predicate.field = field;
+    header_predicates_.push_back(predicate);
+    return *this;
+}
+
+MessageFilter& MessageFilter::property(amqp_flags_t field, Compare op,
+                                       int64_t value)
+{
+    if(!is_numeric_property(field))
+        throw std::invalid_argument("not a numeric property");
+
+    Predicate predicate(property_source, compares);
+    predicate.field = field;
+    predicate.op = op;
+    predicate.value = value;
+    header_predicates_.push_back(predicate);
+    return *this;
+}
+
+MessageFilter& MessageFilter::header_exists(const std::string& key)
+{
+    Predicate predicate(header_source, exists);
+    predicate.key = key;
+    header_predicates_.push_back(predicate);
+    return *this;
+}
+
+MessageFilter& MessageFilter::header(const std::string& key,
+                                     const std::string& pattern)
+{
+    Predicate predicate(header_source, matches, pattern);
+    predicate.key = key;
+    header_predicates_.push_back(predicate);
+    return *this;
+}
+
+MessageFilter& MessageFilter::header(const std::string& key, Compare op,
+                                     int64_t value)
+{
+    Predicate predicate(header_source, compares);
+    predicate.key = key;
+    predicate.op = op;
+    predicate.value = value;
+    header_predicates_.push_back(predicate);
+    return *this;
+}
+
+bool MessageFilter::match(const amqp_basic_deliver_t& deliver) const
+{
+    for(size_t i = 0; i < deliver_predicates_.size(); ++i)
+    {
+        if(!holds(deliver_predicates_[i], deliver))
+            return false;
+    }
+    return true;
+}
+
+bool MessageFilter::match(const amqp_basic_properties_t& properties) const
+{
+    for(size_t i = 0; i < header_predicates_.size(); ++i)
+    {
+        if(!holds(header_predicates_[i], properties))
+            return false;
+    }
+    return true;
+}
+
+bool MessageFilter::holds(const Predicate& predicate,
+                          const amqp_basic_deliver_t& deliver)
+{
+    const amqp_bytes_t& value = predicate.source == routing_key_source
+            ? deliver.routing_key : deliver.exchange;
+    return predicate.pattern.match(value);
+}
+
+bool MessageFilter::holds(const Predicate& predicate,
+                          const amqp_basic_properties_t& properties)
+{
+    if(predicate.source == property_source)
+    {
+        // an absent property never matches
+        if((properties._flags & predicate.field) == 0)
+            return false;
+
+        if(predicate.test == compares)
+        {
+            const int64_t value = numeric_property(properties, predicate.field);
+            return compare(value, predicate.op, predicate.value);
+        }
+        return predicate.pattern.match(
+                    *string_property(properties, predicate.field));
+    }
+
+    if((properties._flags & AMQP_BASIC_HEADERS_FLAG) == 0)
+        return false;
+
+    const AmqpTableView headers(properties.headers);
+    const AmqpFieldView field = headers.find(predicate.key);
+    if(!field.valid())
+        return false;
+
+    switch(predicate.test)
+    {
+    case exists:
+        return true;
+
+    case matches:
+        return field.is_bytes() && predicate.pattern.match(field.bytes());
+
+    case compares:
+        return field.is_integer() &&
+                compare(field.integer(), predicate.op, predicate.value);
+    }
+    return false;
+}
+
+DiscardBatch::DiscardBatch(AmqpChannel& channel, Action action,
+                           AckAccumulator* acks, size_t max_batch,
+                           Clock::duration max_delay):
+    channel_(channel),
+    action_(action),
+    max_batch_(max_batch),
+    max_delay_(max_delay),
+    frames_(channel.connection().frame_max()),
+    pending_()
+{
+    frames_.metrics(channel.connection().metrics());
+    if(acks != 0)
+        accumulator(*acks);
+}
+
+void DiscardBatch::accumulator(AckAccumulator& acks)
+{
+    const amqp_channel_t channel = acks.channel().id();
+    if(channel >= acks_.size())
+        acks_.resize(channel + 1);
+    acks_[channel] = &acks;
+}
+
+void DiscardBatch::operator()(amqp_channel_t channel, uint64_t delivery_tag)
+{
+    AckAccumulator* acks = accumulator(channel);
+    if(action_ == drop)
+        return;
+
+    // the accumulator batches acks itself
+    if(action_ == ack && acks != 0)
+    {
+        acks->complete(delivery_tag);
+        return;
+    }
+
+    if(pending_++ == 0)
+        oldest_pending_ = Clock::now();
+
+    if(action_ == ack)
+    {
+        amqp_basic_ack_t method;
+        method.delivery_tag = delivery_tag;
+        method.multiple = 0;
+        frames_.method(channel, AMQP_BASIC_ACK_METHOD, &method);
+    }
+    else if(acks != 0)
+        acks->defer_reject(delivery_tag, false);
+    else
+    {
+        amqp_basic_reject_t method;
+        method.delivery_tag = delivery_tag;
+        method.requeue = 0;
+        frames_.method(channel, AMQP_BASIC_REJECT_METHOD, &method);
+    }
+
+    if(pending_ >= max_batch_)
+        flush();
+}
+
+void DiscardBatch::poll()
+{
+    for(size_t i = 0; i < acks_.size(); ++i)
+    {
+        if(acks_[i] != 0)
+            acks_[i]->poll();
+    }
+
+    if(pending_ > 0 && Clock::now() - oldest_pending_ >= max_delay_)
+        flush();
+}
+
+void DiscardBatch::flush()
+{
+    pending_ = 0;
+    for(size_t i = 0; i < acks_.size(); ++i)
+    {
+        if(acks_[i] != 0)
+            acks_[i]->flush();
+    }
+
+    if(frames_.empty())
+        return;
+
+    const int rc = frames_.send(channel_.connection());
+    check("Settling filtered messages", rc);
+}
+
+DiscardBatch::~DiscardBatch()
+{
+    if(!frames_.empty())
+    {
+        const int rc = frames_.send(channel_.connection());
+        check("Settling filtered messages", rc, true);
+    }
+}
@@ -0,0 +1,170 @@
+#ifndef AMQP_FILTER_HPP
+#define AMQP_FILTER_HPP
+
+#include <string>
+#include <vector>
+#include "amqp_ack.hpp"
+#include "amqp_encoder.hpp"
+#include "amqp_process.hpp"
+
+// Compiled string pattern: text without wildcards is an exact match, text
+// whose only wildcard is a trailing '*' a prefix match, anything else a
+// glob where '*' matches any run of bytes and '?' one byte.
+class AmqpPattern
+{
+public:
+    explicit AmqpPattern(const std::string& pattern);
+
+    bool match(const amqp_bytes_t& value) const;
+
+private:
+    enum Kind
+    {
+        exact,
+        prefix,
+        glob
+    };
+
+    Kind kind_;
+    std::string text_;
+};
+
+// Conjunction of predicates on a delivery, evaluated by AmqpProcessor
+// before the body is assembled. Routing key and exchange predicates run on
+// the deliver frame, property and header predicates on the content header.
+class MessageFilter
+{
+public:
+    enum Compare
+    {
+        equal,
+        not_equal,
+        less,
+        less_equal,
+        greater,
+        greater_equal
+    };
+
+    MessageFilter& routing_key(const std::string& pattern);
+    MessageFilter& exchange(const std::string& pattern);
+
+    // field is one of the AMQP_BASIC_*_FLAG values of a short string
+    // property (content_type, type, app_id, ...)
+    MessageFilter& property(amqp_flags_t field, const std::string& pattern);
+
+    // field is AMQP_BASIC_DELIVERY_MODE_FLAG, AMQP_BASIC_PRIORITY_FLAG or
+    // AMQP_BASIC_TIMESTAMP_FLAG
+    MessageFilter& property(amqp_flags_t field, Compare op, int64_t value);
+
+    MessageFilter& header_exists(const std::string& key);
+    MessageFilter& header(const std::string& key, const std::string& pattern);
+    MessageFilter& header(const std::string& key, Compare op, int64_t value);
+
+    bool match(const amqp_basic_deliver_t& deliver) const;
+    bool match(const amqp_basic_properties_t& properties) const;
+
+private:
+    enum Source
+    {
+        routing_key_source,
+        exchange_source,
+        property_source,
+        header_source
+    };
+
+    enum Test
+    {
+        exists,
+        matches,
+        compares
+    };
+
+    struct Predicate
+    {
+        Predicate(Source s, Test t, const std::string& pattern = std::string()):
+            source(s),
+            test(t),
+            pattern(pattern),
+            field(),
+            op(),
+            value()
+        {}
+
+        Source source;
+        Test test;
+        AmqpPattern pattern;
+        amqp_flags_t field;
+        std::string key;
+        Compare op;
+        int64_t value;
+    };
+
+    static bool holds(const Predicate& predicate,
+                      const amqp_basic_deliver_t& deliver);
+    static bool holds(const Predicate& predicate,
+                      const amqp_basic_properties_t& properties);
+
+    std::vector<Predicate> deliver_predicates_;
+    std::vector<Predicate> header_predicates_;
+};
+
+// Settles filtered-out deliveries in bulk. drop does nothing (no_ack
+// consumers); ack completes them through the channel's AckAccumulator so
+// they fold into multiple=true acks with the accepted messages; reject
+// encodes basic.reject frames, without requeue, and sends them in one
+// write once max_batch are queued or, from poll(), once the oldest is
+// older than max_delay. Install it with
+// AmqpProcessor::filter(&filter, boost::ref(batch)).
+//
+// When the accepted messages are acked through an AckAccumulator, pass it
+// for reject as well: the rejects are then queued in the accumulator,
+// which keeps its ack ranges clear of them and sends them ahead of any
+// ack above them. Delivery tags belong to a channel, so when the
+// processor serves several channels, add the accumulator of each with
+// accumulator(); deliveries of a channel without one are settled with
+// plain basic.ack or basic.reject frames.
+class DiscardBatch: boost::noncopyable
+{
+public:
+    typedef AckAccumulator::Clock Clock;
+
+    enum Action
+    {
+        drop,
+        ack,
+        reject
+    };
+
+    DiscardBatch(AmqpChannel& channel, Action action,
+                 AckAccumulator* acks = 0, size_t max_batch = 64,
+                 Clock::duration max_delay = boost::chrono::milliseconds(100));
+
+    // Settles the deliveries of acks.channel() through acks.
+    void accumulator(AckAccumulator& acks);
+
+    void operator()(amqp_channel_t channel, uint64_t delivery_tag);
+
+    // Flushes if the oldest queued reject is due; call it from the loop
+    // like AckAccumulator::poll().
+    void poll();
+    void flush();
+
+    ~DiscardBatch();
+
+private:
+    AckAccumulator* accumulator(amqp_channel_t channel) const
+    {
+        return channel < acks_.size() ? acks_[channel] : 0;
+    }
+
+    AmqpChannel& channel_;
+    const Action action_;
+    std::vector<AckAccumulator*> acks_; // by channel id
+    const size_t max_batch_;
+    const Clock::duration max_delay_;
+    FrameEncoder frames_;
+    size_t pending_;
+    Clock::time_point oldest_pending_;
+};
+
+#endif // AMQP_FILTER_HPP
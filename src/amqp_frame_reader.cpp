@@ -0,0 +1,285 @@
+#include "amqp_frame_reader.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "amqp_encoder.hpp"
+
+namespace
+{
+    // method id, or class id, weight and body size of a header frame
+    const size_t method_id_size = 4;
+    const size_t header_prefix_size = 12;
+
+    inline uint16_t read_u16(const char* data)
+    {
+        uint16_t value;
+        memcpy(&value, data, sizeof value);
+        return ntohs(value);
+    }
+
+    inline uint32_t read_u32(const char* data)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof value);
+        return ntohl(value);
+    }
+
+    inline uint64_t read_u64(const char* data)
+    {
+        return (uint64_t(read_u32(data)) << 32) | read_u32(data + 4);
+    }
+
+    // Maps the same size bytes twice, back to back, so data wrapping
+    // around the end of the ring can be read through the second mapping.
+    char* map_mirrored(size_t size)
+    {
+        const int fd = memfd_create("amqp-frame-reader", MFD_CLOEXEC);
+        check_os("Creating frame reader ring", fd);
+
+        void* base = MAP_FAILED;
+        if(ftruncate(fd, size) == 0)
+            base = mmap(0, 2 * size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        bool mapped = base != MAP_FAILED;
+        for(int i = 0; mapped && i < 2; ++i)
+        {
+            void* half = static_cast<char*>(base) + i * size;
+            mapped = mmap(half, size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+        }
+
+        const int saved_errno = errno;
+        close(fd);
+        if(!mapped)
+        {
+            if(base != MAP_FAILED)
+                munmap(base, 2 * size);
+            errno = saved_errno;
+            check_os("Mapping frame reader ring", -1);
+        }
+        return static_cast<char*>(base);
+    }
+}
+
+FrameReader::FrameReader(AmqpConnection& conn, size_t capacity):
+    conn_(conn),
+    capacity_(capacity),
+    ring_(),
+    start_(),
+    decoded_(),
+    end_(),
+    librabbitmq_frames_(false),
+    librabbitmq_partial_(false)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t frame_max = conn_.frame_max();
+    capacity_ = std::max(capacity_, frame_max);
+    capacity_ = (capacity_ + page - 1) / page * page;
+
+    ring_ = map_mirrored(capacity_);
+    init_amqp_pool(&pool_, 1 << 16);
+    frames_.reserve(256);
+}
+
+FrameReader::~FrameReader()
+{
+    empty_amqp_pool(&pool_);
+    munmap(ring_, 2 * capacity_);
+}
+
+void FrameReader::release()
+{
+    frames_.clear();
+    recycle_amqp_pool(&pool_);
+    start_ = decoded_;
+
+    if(librabbitmq_frames_)
+    {
+        conn_.release_buffers();
+        librabbitmq_frames_ = false;
+    }
+}
+
+int FrameReader::read(int timeout_ms)
+{
+    release();
+
+    // frames librabbitmq read during setup RPCs never show up as socket
+    // readiness; they are older than anything in the ring
+    if(librabbitmq_partial_ || amqp_frames_enqueued(conn_) ||
+            amqp_data_in_buffer(conn_))
+        return read_pending(timeout_ms);
+
+    while(frames_.empty())
+    {
+        const int received = receive(timeout_ms);
+        if(received <= 0)
+            return received;
+
+        const int rc = decode();
+        if(rc < 0)
+            return rc;
+    }
+    return frames_.size();
+}
+
+int FrameReader::read_pending(int timeout_ms)
+{
+    librabbitmq_frames_ = true;
+    bool first = true;
+    while(first || amqp_frames_enqueued(conn_) || amqp_data_in_buffer(conn_))
+    {
+        // the buffer may end in part of a frame, whose rest librabbitmq
+        // must read from the socket too; only the first wait may block
+        amqp_frame_t frame;
+        const int rc = conn_.wait_frame(frame, first ? timeout_ms : 0);
+        first = false;
+        librabbitmq_partial_ = rc == os_error(ETIMEDOUT);
+        if(librabbitmq_partial_)
+            break;
+        if(rc < 0)
+            return rc;
+
+        if(ConnectionMetrics* metrics = conn_.metrics())
+            metrics->frame_in(frame);
+        if(frame.frame_type != AMQP_FRAME_HEARTBEAT)
+            frames_.push_back(frame);
+    }
+    return frames_.size();
+}
+
+int FrameReader::receive(int timeout_ms)
+{
+    const size_t used = end_ - start_;
+    if(used == capacity_)
+        return bad_data_error();
+
+    if(Transport* transport = conn_.transport())
+    {
+        const int received =
+                transport->receive(at(end_), capacity_ - used, timeout_ms);
+        if(received > 0)
+            end_ += received;
+        return received;
+    }
+
+    if(timeout_ms >= 0)
+    {
+        pollfd fd = pollfd();
+        fd.fd = conn_.sockfd();
+        fd.events = POLLIN;
+
+        int rc;
+        do
+            rc = poll(&fd, 1, timeout_ms);
+        while(rc < 0 && errno == EINTR);
+
+        if(rc <= 0)
+            return rc < 0 ? socket_error() : 0;
+    }
+
+    // the free space is contiguous through the second mapping
+    ssize_t received;
+    do
+        received = recv(conn_.sockfd(), at(end_), capacity_ - used, 0);
+    while(received < 0 && errno == EINTR);
+
+    if(received <= 0)
+        return received == 0 ? connection_closed_error() : socket_error();
+
+    end_ += received;
+    return received;
+}
+
+int FrameReader::decode()
+{
+    ConnectionMetrics* metrics = conn_.metrics();
+
+    while(end_ - decoded_ >= FrameEncoder::frame_header_size)
+    {
+        char* data = at(decoded_);
+        const uint8_t type = data[0];
+        const amqp_channel_t channel = read_u16(data + 1);
+        const uint32_t size = read_u32(data + 3);
+
+        const size_t frame_size = size + FrameEncoder::frame_overhead;
+        if(frame_size > capacity_)
+            return bad_data_error();
+        if(end_ - decoded_ < frame_size)
+            break;
+
+        char* payload = data + FrameEncoder::frame_header_size;
+        if(static_cast<uint8_t>(payload[size]) != AMQP_FRAME_END)
+            return bad_data_error();
+
+        decoded_ += frame_size;
+        if(metrics != 0)
+            metrics->frame_in(type, frame_size);
+        if(type == AMQP_FRAME_HEARTBEAT)
+            continue;
+
+        frames_.push_back(amqp_frame_t());
+        const int rc = decode_frame(payload, type, channel, size,
+                                    frames_.back());
+        if(rc < 0)
+            return rc;
+    }
+    return 0;
+}
+
+int FrameReader::decode_frame(char* data, uint8_t type,
+                              amqp_channel_t channel, uint32_t size,
+                              amqp_frame_t& frame)
+{
+    frame.frame_type = type;
+    frame.channel = channel;
+
+    switch(type)
+    {
+    case AMQP_FRAME_METHOD:
+        {
+            if(size < method_id_size)
+                return bad_data_error();
+
+            amqp_bytes_t encoded;
+            encoded.bytes = data + method_id_size;
+            encoded.len = size - method_id_size;
+
+            frame.payload.method.id = read_u32(data);
+            return amqp_decode_method(frame.payload.method.id, &pool_,
+                                      encoded,
+                                      &frame.payload.method.decoded);
+        }
+
+    case AMQP_FRAME_HEADER:
+        {
+            if(size < header_prefix_size)
+                return bad_data_error();
+
+            amqp_bytes_t encoded;
+            encoded.bytes = data + header_prefix_size;
+            encoded.len = size - header_prefix_size;
+
+            frame.payload.properties.class_id = read_u16(data);
+            frame.payload.properties.body_size = read_u64(data + 4);
+            frame.payload.properties.raw = encoded;
+            return amqp_decode_properties(frame.payload.properties.class_id,
+                                          &pool_, encoded,
+                                          &frame.payload.properties.decoded);
+        }
+
+    case AMQP_FRAME_BODY:
+        frame.payload.body_fragment.bytes = data;
+        frame.payload.body_fragment.len = size;
+        return 0;
+
+    default:
+        return bad_data_error();
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef AMQP_FRAME_READER_HPP
+#define AMQP_FRAME_READER_HPP
+
+#include <vector>
+#include "amqp_connection.hpp"
+
+// Reads frames of a connection in batches, bypassing amqp_simple_wait_frame.
+// The socket is read into a large ring buffer, one recv() taking whatever
+// the kernel has, and every complete frame in the ring is decoded at once.
+// Method and header frames are decoded into the reader's own pool; body
+// fragments point straight into the ring. The ring is mapped twice back
+// to back, so a frame that wraps around its end is still contiguous.
+// Data comes from the connection's transport when it has one.
+//
+// Frames handed out stay valid until the next read() or release(). The
+// capacity must hold at least one frame of the connection's frame_max.
+// Use the reader only after the connection is set up, and do not mix it
+// with librabbitmq calls that read the socket (synchronous RPCs); frames
+// librabbitmq had already buffered are returned by the first read(), and
+// reads go through librabbitmq until it no longer holds part of a frame.
+class FrameReader: boost::noncopyable
+{
+public:
+    explicit FrameReader(AmqpConnection& conn, size_t capacity = 1 << 20);
+
+    // Releases the previous batch and waits up to timeout_ms (-1 for no
+    // limit) for at least one frame. Returns the number of frames read,
+    // 0 on timeout, or a librabbitmq-style error code. Heartbeats are
+    // counted in the metrics but not returned.
+    int read(int timeout_ms = -1);
+
+    const amqp_frame_t& operator[](size_t index) const
+    {
+        return frames_[index];
+    }
+
+    size_t size() const
+    {
+        return frames_.size();
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    // Bytes received but not yet decoded, i.e. the start of a frame.
+    size_t buffered() const
+    {
+        return end_ - decoded_;
+    }
+
+    // Hands the ring space and decoded frames of the batch back early.
+    void release();
+
+    ~FrameReader();
+
+private:
+    int read_pending(int timeout_ms);
+    int receive(int timeout_ms);
+    int decode();
+    int decode_frame(char* data, uint8_t type, amqp_channel_t channel,
+                     uint32_t size, amqp_frame_t& frame);
+
+    char* at(uint64_t position) const
+    {
+        return ring_ + position % capacity_;
+    }
+
+    AmqpConnection& conn_;
+    size_t capacity_;
+    char* ring_;
+    amqp_pool_t pool_;
+
+    // positions in the ring, counted since the start; space before
+    // start_ is free, [start_, decoded_) holds the current batch and
+    // [decoded_, end_) a partially received frame
+    uint64_t start_;
+    uint64_t decoded_;
+    uint64_t end_;
+
+    std::vector<amqp_frame_t> frames_;
+    bool librabbitmq_frames_;
+    bool librabbitmq_partial_; // it holds the start of a frame
+};
+
+#endif // AMQP_FRAME_READER_HPP
@@ -0,0 +1,299 @@
+#include "amqp_metrics.hpp"
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <boost/align/aligned_alloc.hpp>
+#include "amqp_encoder.hpp"
+
+namespace
+{
+    inline uint64_t now_us()
+    {
+        typedef boost::chrono::system_clock SystemClock;
+        return boost::chrono::duration_cast<boost::chrono::microseconds>(
+                    SystemClock::now().time_since_epoch()).count();
+    }
+
+    inline uint64_t to_us(uint64_t timestamp,
+                          ChannelMetrics::TimestampUnit unit)
+    {
+        switch(unit)
+        {
+        case ChannelMetrics::seconds:
+            return timestamp * 1000000;
+
+        case ChannelMetrics::milliseconds:
+            return timestamp * 1000;
+
+        default:
+            return timestamp;
+        }
+    }
+
+    void write_histogram(std::ostream& out, const std::string& name,
+                         const std::string& labels,
+                         const HistogramSnapshot& histogram)
+    {
+        const double quantiles[] = { 50, 90, 99, 99.9 };
+        for(size_t i = 0; i < sizeof quantiles / sizeof quantiles[0]; ++i)
+        {
+            out << name << "{" << labels << ",quantile=\""
+                << quantiles[i] / 100 << "\"} "
+                << histogram.percentile(quantiles[i]) << "\n";
+        }
+        out << name << "_max{" << labels << "} " << histogram.max << "\n";
+        out << name << "_sum{" << labels << "} " << histogram.sum << "\n";
+        out << name << "_count{" << labels << "} " << histogram.total << "\n";
+    }
+}
+
+void* CacheAligned::operator new(size_t size)
+{
+    void* p = boost::alignment::aligned_alloc(PaddedCounter::cache_line, size);
+    if(p == 0)
+        throw std::bad_alloc();
+    return p;
+}
+
+void CacheAligned::operator delete(void* p)
+{
+    boost::alignment::aligned_free(p);
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const
+{
+    const uint64_t rank = static_cast<uint64_t>(p / 100 * total);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < counts.size(); ++i)
+    {
+        seen += counts[i];
+        if(seen > rank)
+            return AtomicHistogram::value(i);
+    }
+    return max;
+}
+
+AtomicHistogram::AtomicHistogram():
+    counts_(new boost::atomic<uint64_t>[bucket_count]),
+    max_(0)
+{
+    for(size_t i = 0; i < bucket_count; ++i)
+        counts_[i].store(0, boost::memory_order_relaxed);
+}
+
+size_t AtomicHistogram::index(uint64_t value)
+{
+    if(value < sub_buckets)
+        return value;
+    const unsigned log2 = 63 - __builtin_clzll(value);
+    const uint64_t sub = (value >> (log2 - 4)) & (sub_buckets - 1);
+    return (log2 - 3) * sub_buckets + sub;
+}
+
+uint64_t AtomicHistogram::value(size_t index)
+{
+    if(index < sub_buckets)
+        return index;
+    const unsigned log2 = index / sub_buckets + 3;
+    const uint64_t sub = index % sub_buckets;
+    return (uint64_t(1) << log2) | (sub << (log2 - 4));
+}
+
+void AtomicHistogram::record(uint64_t value)
+{
+    counts_[index(value)].fetch_add(1, boost::memory_order_relaxed);
+    sum_.add(value);
+
+    uint64_t max = max_.load(boost::memory_order_relaxed);
+    while(value > max &&
+          !max_.compare_exchange_weak(max, value, boost::memory_order_relaxed))
+    {}
+}
+
+HistogramSnapshot AtomicHistogram::snapshot() const
+{
+    HistogramSnapshot result;
+    result.counts.resize(bucket_count);
+    for(size_t i = 0; i < bucket_count; ++i)
+    {
+        result.counts[i] = counts_[i].load(boost::memory_order_relaxed);
+        result.total += result.counts[i];
+    }
+    result.sum = sum_.load();
+    result.max = max_.load(boost::memory_order_relaxed);
+    return result;
+}
+
+ChannelMetrics::ChannelMetrics(amqp_channel_t channel, TimestampUnit unit):
+    channel_(channel),
+    unit_(unit),
+    previous_deliveries_()
+{}
+
+void ChannelMetrics::delivered(uint64_t delivery_tag, uint64_t body_size,
+                               const amqp_basic_properties_t* properties)
+{
+    deliveries_.add();
+    body_bytes_.add(body_size);
+    last_delivery_tag_.set(delivery_tag);
+    body_size_.record(body_size);
+
+    if(properties != 0 &&
+            (properties->_flags & AMQP_BASIC_TIMESTAMP_FLAG) != 0)
+    {
+        const uint64_t sent = to_us(properties->timestamp, unit_);
+        const uint64_t now = now_us();
+        // clocks of publisher and consumer may disagree
+        latency_.record(now > sent ? now - sent : 0);
+    }
+}
+
+void ChannelMetrics::acked(uint64_t acked_upto)
+{
+    acked_upto_.set(acked_upto);
+}
+
+const char* ConnectionSnapshot::type_name(size_t type)
+{
+    static const char* const names[frame_type_count] =
+    {
+        "method",
+        "header",
+        "body",
+        "heartbeat",
+        "other"
+    };
+    return names[type];
+}
+
+ConnectionMetrics::ConnectionMetrics(amqp_channel_t max_channel,
+                                     ChannelMetrics::TimestampUnit unit):
+    max_channel_(max_channel),
+    unit_(unit),
+    channels_(new boost::atomic<ChannelMetrics*>[max_channel + 1]),
+    previous_snapshot_(Clock::now())
+{
+    for(size_t i = 0; i <= max_channel_; ++i)
+        channels_[i].store(0, boost::memory_order_relaxed);
+}
+
+ConnectionMetrics::~ConnectionMetrics()
+{
+    for(size_t i = 0; i <= max_channel_; ++i)
+        delete channels_[i].load(boost::memory_order_relaxed);
+}
+
+void ConnectionMetrics::frame_in(const amqp_frame_t& frame)
+{
+    size_t size = FrameEncoder::frame_overhead;
+    if(frame.frame_type == AMQP_FRAME_BODY)
+        size += frame.payload.body_fragment.len;
+    frame_in(frame.frame_type, size);
+}
+
+ChannelMetrics* ConnectionMetrics::channel(amqp_channel_t channel)
+{
+    if(channel > max_channel_)
+        return 0;
+
+    boost::atomic<ChannelMetrics*>& slot = channels_[channel];
+    ChannelMetrics* metrics = slot.load(boost::memory_order_acquire);
+    if(metrics != 0)
+        return metrics;
+
+    ChannelMetrics* created = new ChannelMetrics(channel, unit_);
+    if(slot.compare_exchange_strong(metrics, created,
+                                    boost::memory_order_acq_rel))
+        return created;
+
+    // another thread won
+    delete created;
+    return metrics;
+}
+
+ConnectionSnapshot ConnectionMetrics::snapshot()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    ConnectionSnapshot result;
+    for(size_t i = 0; i < ConnectionSnapshot::frame_type_count; ++i)
+    {
+        result.frames_in[i] = frames_in_[i].load();
+        result.bytes_in[i] = bytes_in_[i].load();
+        result.frames_out[i] = frames_out_[i].load();
+        result.bytes_out[i] = bytes_out_[i].load();
+    }
+    result.unprocessed_frames = unprocessed_frames_.load();
+
+    const Clock::time_point now = Clock::now();
+    result.seconds =
+            boost::chrono::duration<double>(now - previous_snapshot_).count();
+    previous_snapshot_ = now;
+
+    for(size_t i = 0; i <= max_channel_; ++i)
+    {
+        ChannelMetrics* metrics =
+                channels_[i].load(boost::memory_order_acquire);
+        if(metrics == 0)
+            continue;
+
+        ChannelSnapshot channel;
+        channel.channel = metrics->channel_;
+        channel.deliveries = metrics->deliveries_.load();
+        channel.deliveries_per_second = result.seconds > 0
+                ? (channel.deliveries - metrics->previous_deliveries_) /
+                  result.seconds
+                : 0.0;
+        metrics->previous_deliveries_ = channel.deliveries;
+
+        channel.body_bytes = metrics->body_bytes_.load();
+        channel.last_delivery_tag = metrics->last_delivery_tag_.load();
+        channel.acked_upto = metrics->acked_upto_.load();
+        channel.ack_lag = channel.last_delivery_tag > channel.acked_upto
+                ? channel.last_delivery_tag - channel.acked_upto : 0;
+        channel.body_size = metrics->body_size_.snapshot();
+        channel.latency = metrics->latency_.snapshot();
+        result.channels.push_back(channel);
+    }
+    return result;
+}
+
+void write_text(std::ostream& out, const ConnectionSnapshot& snapshot,
+                const std::string& prefix)
+{
+    for(size_t i = 0; i < ConnectionSnapshot::frame_type_count; ++i)
+    {
+        const char* type = ConnectionSnapshot::type_name(i);
+        out << prefix << "_frames_in{type=\"" << type << "\"} "
+            << snapshot.frames_in[i] << "\n";
+        out << prefix << "_bytes_in{type=\"" << type << "\"} "
+            << snapshot.bytes_in[i] << "\n";
+        out << prefix << "_frames_out{type=\"" << type << "\"} "
+            << snapshot.frames_out[i] << "\n";
+        out << prefix << "_bytes_out{type=\"" << type << "\"} "
+            << snapshot.bytes_out[i] << "\n";
+    }
+    out << prefix << "_unprocessed_frames " << snapshot.unprocessed_frames
+        << "\n";
+
+    for(size_t i = 0; i < snapshot.channels.size(); ++i)
+    {
+        const ChannelSnapshot& channel = snapshot.channels[i];
+        std::ostringstream label_stream;
+        label_stream << "channel=\"" << channel.channel << "\"";
+        const std::string labels = label_stream.str();
+
+        out << prefix << "_deliveries{" << labels << "} "
+            << channel.deliveries << "\n";
+        out << prefix << "_deliveries_per_second{" << labels << "} "
+            << channel.deliveries_per_second << "\n";
+        out << prefix << "_body_bytes{" << labels << "} "
+            << channel.body_bytes << "\n";
+        out << prefix << "_ack_lag{" << labels << "} "
+            << channel.ack_lag << "\n";
+        write_histogram(out, prefix + "_body_size", labels,
+                        channel.body_size);
+        write_histogram(out, prefix + "_latency_us", labels,
+                        channel.latency);
+    }
+}
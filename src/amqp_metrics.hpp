@@ -0,0 +1,265 @@
+#ifndef AMQP_METRICS_HPP
+#define AMQP_METRICS_HPP
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/config.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+#include <amqp.h>
+
+// Counter aligned to a cache line, so counters bumped by different threads
+// never share one. Classes holding them derive from CacheAligned when they
+// are allocated with new.
+class BOOST_ALIGNMENT(64) PaddedCounter: boost::noncopyable
+{
+public:
+    static const size_t cache_line = 64;
+
+    PaddedCounter():
+        value_(0)
+    {}
+
+    void add(uint64_t value = 1)
+    {
+        value_.fetch_add(value, boost::memory_order_relaxed);
+    }
+
+    void set(uint64_t value)
+    {
+        value_.store(value, boost::memory_order_relaxed);
+    }
+
+    uint64_t load() const
+    {
+        return value_.load(boost::memory_order_relaxed);
+    }
+
+private:
+    boost::atomic<uint64_t> value_;
+};
+
+// operator new before C++17 ignores alignment beyond max_align_t.
+struct CacheAligned
+{
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+};
+
+struct HistogramSnapshot
+{
+    HistogramSnapshot():
+        total(),
+        sum(),
+        max()
+    {}
+
+    // Lower bound of the bucket holding the p-th percentile.
+    uint64_t percentile(double p) const;
+
+    double mean() const
+    {
+        return total == 0 ? 0.0 : double(sum) / total;
+    }
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+};
+
+// HDR-style log-linear histogram over 64-bit values: every power of two
+// is split into sub_buckets linear buckets, so any recorded value is off
+// by at most 1/sub_buckets of itself. Buckets are relaxed atomics;
+// record() may run on any thread.
+class AtomicHistogram: boost::noncopyable
+{
+public:
+    static const unsigned sub_buckets = 16;
+    static const size_t bucket_count = 61 * sub_buckets;
+
+    AtomicHistogram();
+
+    void record(uint64_t value);
+    HistogramSnapshot snapshot() const;
+
+    static size_t index(uint64_t value);
+    static uint64_t value(size_t index);
+
+private:
+    boost::scoped_array<boost::atomic<uint64_t> > counts_;
+    PaddedCounter sum_;
+    boost::atomic<uint64_t> max_;
+};
+
+struct ChannelSnapshot
+{
+    amqp_channel_t channel;
+    uint64_t deliveries;
+    double deliveries_per_second; // since the previous snapshot
+    uint64_t body_bytes;
+    uint64_t last_delivery_tag;
+    uint64_t acked_upto;
+    uint64_t ack_lag; // deliveries not acknowledged yet
+    HistogramSnapshot body_size; // bytes
+    HistogramSnapshot latency; // publish to consume, microseconds
+};
+
+// Delivery side metrics of one channel.
+class ChannelMetrics: public CacheAligned, boost::noncopyable
+{
+public:
+    enum TimestampUnit
+    {
+        seconds,
+        milliseconds,
+        microseconds
+    };
+
+    explicit ChannelMetrics(amqp_channel_t channel,
+                            TimestampUnit unit = seconds);
+
+    // Latency is measured against the timestamp property, read in the
+    // given unit; the AMQP spec says seconds, but many publishers put
+    // milliseconds there. Messages without a timestamp are not measured.
+    void delivered(uint64_t delivery_tag, uint64_t body_size,
+                   const amqp_basic_properties_t* properties);
+    void acked(uint64_t acked_upto);
+
+    amqp_channel_t channel() const
+    {
+        return channel_;
+    }
+
+private:
+    friend class ConnectionMetrics;
+
+    const amqp_channel_t channel_;
+    const TimestampUnit unit_;
+    PaddedCounter deliveries_;
+    PaddedCounter body_bytes_;
+    PaddedCounter last_delivery_tag_;
+    PaddedCounter acked_upto_;
+    AtomicHistogram body_size_;
+    AtomicHistogram latency_;
+
+    // guarded by ConnectionMetrics::mutex_
+    uint64_t previous_deliveries_;
+};
+
+struct ConnectionSnapshot
+{
+    enum FrameType
+    {
+        method,
+        header,
+        body,
+        heartbeat,
+        other,
+        frame_type_count
+    };
+
+    static const char* type_name(size_t type);
+
+    uint64_t frames_in[frame_type_count];
+    uint64_t bytes_in[frame_type_count];
+    uint64_t frames_out[frame_type_count];
+    uint64_t bytes_out[frame_type_count];
+    uint64_t unprocessed_frames; // frames AmqpProcessor could not place
+    double seconds; // since the previous snapshot
+    std::vector<ChannelSnapshot> channels;
+};
+
+// Frame and delivery metrics of a connection. Install it with
+// AmqpConnection::metrics(); AmqpEventLoop then counts incoming frames
+// with their exact wire size, FrameEncoders made from the connection
+// (batches, templates, channel pools) count outgoing ones once they are
+// written, and AckAccumulator reports acks. Frames read or sent by
+// librabbitmq calls directly are not counted. Updates are lock-free;
+// snapshot() takes a mutex to compute rates.
+class ConnectionMetrics: public CacheAligned, boost::noncopyable
+{
+public:
+    typedef ConnectionSnapshot::FrameType FrameType;
+
+    explicit ConnectionMetrics(amqp_channel_t max_channel = 64,
+                               ChannelMetrics::TimestampUnit unit =
+                                   ChannelMetrics::seconds);
+
+    void frame_in(uint8_t frame_type, size_t wire_size)
+    {
+        const FrameType type = frame_type_index(frame_type);
+        frames_in_[type].add();
+        bytes_in_[type].add(wire_size);
+    }
+
+    // For frames that did not come through AmqpEventLoop; only the size
+    // of body frames is known then, others count the frame overhead.
+    void frame_in(const amqp_frame_t& frame);
+
+    void frame_out(uint8_t frame_type, size_t wire_size)
+    {
+        const FrameType type = frame_type_index(frame_type);
+        frames_out_[type].add();
+        bytes_out_[type].add(wire_size);
+    }
+
+    void unprocessed_frame()
+    {
+        unprocessed_frames_.add();
+    }
+
+    // Null for channels above max_channel.
+    ChannelMetrics* channel(amqp_channel_t channel);
+
+    ConnectionSnapshot snapshot();
+
+    ~ConnectionMetrics();
+
+private:
+    typedef boost::chrono::steady_clock Clock;
+
+    static FrameType frame_type_index(uint8_t frame_type)
+    {
+        switch(frame_type)
+        {
+        case AMQP_FRAME_METHOD:
+            return ConnectionSnapshot::method;
+
+        case AMQP_FRAME_HEADER:
+            return ConnectionSnapshot::header;
+
+        case AMQP_FRAME_BODY:
+            return ConnectionSnapshot::body;
+
+        case AMQP_FRAME_HEARTBEAT:
+            return ConnectionSnapshot::heartbeat;
+
+        default:
+            return ConnectionSnapshot::other;
+        }
+    }
+
+    const amqp_channel_t max_channel_;
+    const ChannelMetrics::TimestampUnit unit_;
+    PaddedCounter frames_in_[ConnectionSnapshot::frame_type_count];
+    PaddedCounter bytes_in_[ConnectionSnapshot::frame_type_count];
+    PaddedCounter frames_out_[ConnectionSnapshot::frame_type_count];
+    PaddedCounter bytes_out_[ConnectionSnapshot::frame_type_count];
+    PaddedCounter unprocessed_frames_;
+    boost::scoped_array<boost::atomic<ChannelMetrics*> > channels_;
+
+    boost::mutex mutex_;
+    Clock::time_point previous_snapshot_;
+};
+
+// Writes the snapshot as "name{labels} value" lines, one per counter and
+// per histogram percentile.
+void write_text(std::ostream& out, const ConnectionSnapshot& snapshot,
+                const std::string& prefix = "amqp");
+
+#endif // AMQP_METRICS_HPP
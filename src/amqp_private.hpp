@@ -1,11 +1,14 @@
 #ifndef AMQP_TYPES_PRIVATE_HPP
 #define AMQP_TYPES_PRIVATE_HPP
 
+#include <deque>
 #include "amqp_types.hpp"
 
+// deques, so that adding never moves the entries the raw amqp_* views of
+// the tables and arrays sharing the storage point into
 struct AmqpArrayData
 {
-    std::vector<AmqpFieldValue> entries;
+    std::deque<AmqpFieldValue> entries;
 };
 
 class AmqpTableEntry
@@ -25,7 +28,8 @@ private:
 
 struct AmqpTableData
 {
-    std::vector<AmqpTableEntry> entries;
+    std::deque<AmqpTableEntry> entries;
+    boost::shared_ptr<AmqpTableData> base; // entries a fork() started with
 };
 
 #endif // AMQP_TYPES_PRIVATE_HPP
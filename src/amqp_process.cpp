@@ -1,7 +1,8 @@
 #include "amqp_process.hpp"
-#include "amqp_listener.hpp"
+#include <stdexcept>
+#include "amqp_filter.hpp"
+#include "amqp_metrics.hpp"
 #include "util.hpp"
-#include <iostream>
 
 namespace
 {
@@ -46,45 +47,88 @@ namespace
 }
 
 AmqpProcessor::AmqpProcessor():
-    listener_(new AmqpListener)
-{
-    listener_->start();
-}
+    filter_(),
+    metrics_()
+{}
 
 AmqpProcessor::~AmqpProcessor()
 {}
 
+void AmqpProcessor::filter(const MessageFilter* filter,
+                           const DiscardHandler& on_discard)
+{
+    filter_ = filter;
+    on_discard_ = on_discard;
+}
+
+void AmqpProcessor::discard(amqp_channel_t channel, const Assembly& delivery)
+{
+    if(on_discard_)
+        on_discard_(channel, delivery.delivery_tag);
+}
+
 AmqpProcessor::Result AmqpProcessor::process_frame(const amqp_frame_t& frame)
 {
     Result result;
+    Assembly& delivery = assembly(frame.channel);
 
     if(is_deliver(frame))
     {
-        listener_->process_event(Deliver());
-        result = delivery_decoded(frame);
+        const amqp_basic_deliver_t* deliver = delivery_decoded(frame);
+        delivery.delivery_tag = deliver->delivery_tag;
+
+        if(filter_ != 0 && !filter_->match(*deliver))
+        {
+            delivery.stage = skipping_header;
+            discard(frame.channel, delivery);
+        }
+        else
+        {
+            delivery.stage = header_expected;
+            result = deliver;
+        }
     }
-    else if(is_header(frame))
+    else if(is_header(frame) && (delivery.stage == header_expected ||
+                                 delivery.stage == skipping_header))
     {
-        listener_->process_event(Header(body_size(frame)));
-        result = properties(frame);
+        delivery.body_size = body_size(frame);
+        delivery.received_size = 0;
+
+        bool skip = delivery.stage == skipping_header;
+        if(!skip && filter_ != 0 && !filter_->match(*properties(frame)))
+        {
+            skip = true;
+            discard(frame.channel, delivery);
+        }
+
+        if(delivery.body_size == 0)
+            delivery.stage = waiting;
+        else
+            delivery.stage = skip ? skipping_body : receiving;
+
+        if(!skip)
+            result = ContentHeader(properties(frame), delivery.body_size);
     }
-    else if(is_body(frame))
+    else if(is_body(frame) && delivery.stage == receiving)
     {
         amqp_bytes_t fragment = get_body_fragment(frame);
-        listener_->process_event(Body(fragment.len));
-
-        AmqpListener::Delivery& delivery =
-                listener_->get_state<AmqpListener::Delivery&>();
-
-        bool last = delivery.is_flag_active<Delivered>();
+        delivery.received_size += fragment.len;
+
+        bool last = delivery.received_size >= delivery.body_size;
+        if(last)
+            delivery.stage = waiting;
+        if(delivery.received_size > delivery.body_size)
+            throw std::runtime_error("Processing body: more data than "
+                                     "body_size");
         result = std::make_pair(fragment, last);
-
     }
-    else
+    else if(is_body(frame) && delivery.stage == skipping_body)
     {
-        std::cout << "unprocessed frame: " <<  frame.frame_type << std::endl;
+        delivery.received_size += get_body_fragment(frame).len;
+        if(delivery.received_size >= delivery.body_size)
+            delivery.stage = waiting;
     }
+    else if(metrics_ != 0)
+        metrics_->unprocessed_frame();
     return result;
 }
-
-#pragma GCC diagnostic ignored "-Wunused-variable"
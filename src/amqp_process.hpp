@@ -2,27 +2,87 @@
 #define FRAME_DISPATCH_HPP
 
 #include <string>
+#include <vector>
+#include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
-#include <boost/scoped_ptr.hpp>
 #include <boost/variant/variant.hpp>
 #include <amqp.h>
 
-struct AmqpListener;
-
 typedef std::pair<amqp_bytes_t, bool> BodyFragment;
+typedef std::pair<const amqp_basic_properties_t*, uint64_t> ContentHeader;
+
+typedef boost::function<void (amqp_channel_t, uint64_t delivery_tag)>
+    DiscardHandler;
+
+class ConnectionMetrics;
+class MessageFilter;
 
+// Tracks message assembly separately for every channel of a connection.
+// The per-channel state lives in a flat table indexed by channel id, so
+// frames of concurrent deliveries on different channels may interleave
+// freely; callers route each result by frame.channel.
 class AmqpProcessor: boost::noncopyable
 {
 public:
     typedef boost::variant<int, const amqp_basic_deliver_t*,
-    const amqp_basic_properties_t*, BodyFragment> Result;
+    ContentHeader, BodyFragment> Result;
 
     AmqpProcessor();
+
+    // Throws std::runtime_error on body frames longer than the header's
+    // body_size; the delivery is abandoned.
     Result process_frame(const amqp_frame_t& frame);
+
+    // The filter must outlive the processor; pass 0 to remove it.
+    void filter(const MessageFilter* filter,
+                const DiscardHandler& on_discard = DiscardHandler());
+
+    // Counts frames that fit no delivery in progress; null disables it.
+    void metrics(ConnectionMetrics* metrics)
+    {
+        metrics_ = metrics;
+    }
+
     ~AmqpProcessor();
 
 private:
-    boost::scoped_ptr<AmqpListener> listener_;
+    enum Stage
+    {
+        waiting,
+        header_expected,
+        receiving,
+        skipping_header,
+        skipping_body
+    };
+
+    struct Assembly
+    {
+        Assembly():
+            delivery_tag(),
+            body_size(),
+            received_size(),
+            stage(waiting)
+        {}
+
+        uint64_t delivery_tag;
+        uint64_t body_size;
+        uint64_t received_size;
+        Stage stage;
+    };
+
+    Assembly& assembly(amqp_channel_t channel)
+    {
+        if(channel >= channels_.size())
+            channels_.resize(channel + 1);
+        return channels_[channel];
+    }
+
+    void discard(amqp_channel_t channel, const Assembly& delivery);
+
+    std::vector<Assembly> channels_;
+    const MessageFilter* filter_;
+    DiscardHandler on_discard_;
+    ConnectionMetrics* metrics_;
 };
 
 #endif // FRAME_DISPATCH_HPP
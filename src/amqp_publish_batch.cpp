@@ -0,0 +1,65 @@
+#include "amqp_publish_batch.hpp"
+#include <stdexcept>
+
+PublishBatch::PublishBatch(AmqpChannel& channel, size_t flush_size):
+    channel_(channel),
+    flush_size_(flush_size),
+    encoder_(channel.connection().frame_max()),
+    count_()
+{
+    encoder_.metrics(channel.connection().metrics());
+}
+
+void PublishBatch::add(PublishData& data)
+{
+    amqp_basic_publish_t method;
+    method.ticket = 0;
+    method.exchange = data.exchange;
+    method.routing_key = data.routing_key;
+    method.mandatory = data.mandatory;
+    method.immediate = data.immediate;
+
+    const amqp_basic_properties_t properties = data.message.properties;
+    const amqp_bytes_t& body = data.message.body;
+    const amqp_channel_t channel = channel_.id();
+
+    encoder_.method(channel, AMQP_BASIC_PUBLISH_METHOD, &method);
+    encoder_.header(channel, body.len, properties);
+    encoder_.body(channel, body);
+    ++count_;
+
+    if(encoder_.size() >= flush_size_)
+        flush();
+}
+
+void PublishBatch::add(const PublishTemplate& publish_template,
+                       const amqp_bytes_t& body, const PublishFields& fields)
+{
+    if(publish_template.channel_id() != channel_.id())
+        throw std::invalid_argument("publish template for another channel");
+
+    publish_template.encode(encoder_, body, fields);
+    ++count_;
+
+    if(encoder_.size() >= flush_size_)
+        flush();
+}
+
+void PublishBatch::flush()
+{
+    if(encoder_.empty())
+        return;
+
+    count_ = 0;
+    const int rc = encoder_.send(channel_.connection());
+    check("Publishing batch", rc);
+}
+
+PublishBatch::~PublishBatch()
+{
+    if(!encoder_.empty())
+    {
+        const int rc = encoder_.send(channel_.connection());
+        check("Publishing batch", rc, true);
+    }
+}
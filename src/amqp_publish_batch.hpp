@@ -0,0 +1,42 @@
+#ifndef AMQP_PUBLISH_BATCH_HPP
+#define AMQP_PUBLISH_BATCH_HPP
+
+#include "amqp_channel.hpp"
+#include "amqp_encoder.hpp"
+#include "amqp_publish_template.hpp"
+
+// Corked publishing: messages added to the batch are encoded into one
+// buffer and written to the socket with a single send when the batch is
+// flushed, when it grows past flush_size, or when it goes out of scope.
+class PublishBatch: boost::noncopyable
+{
+public:
+    explicit PublishBatch(AmqpChannel& channel, size_t flush_size = 1 << 20);
+
+    void add(PublishData& data);
+
+    // Throws std::invalid_argument if the template is for another channel.
+    void add(const PublishTemplate& publish_template, const amqp_bytes_t& body,
+             const PublishFields& fields = PublishFields());
+    void flush();
+
+    size_t count() const
+    {
+        return count_;
+    }
+
+    size_t size() const
+    {
+        return encoder_.size();
+    }
+
+    ~PublishBatch();
+
+private:
+    AmqpChannel& channel_;
+    const size_t flush_size_;
+    FrameEncoder encoder_;
+    size_t count_;
+};
+
+#endif // AMQP_PUBLISH_BATCH_HPP
@@ -0,0 +1,198 @@
+#include "amqp_publish_template.hpp"
+#include <stdexcept>
+
+namespace
+{
+    // basic class property order on the wire
+    const amqp_flags_t field_order[] =
+    {
+        AMQP_BASIC_CONTENT_TYPE_FLAG,
+        AMQP_BASIC_CONTENT_ENCODING_FLAG,
+        AMQP_BASIC_HEADERS_FLAG,
+        AMQP_BASIC_DELIVERY_MODE_FLAG,
+        AMQP_BASIC_PRIORITY_FLAG,
+        AMQP_BASIC_CORRELATION_ID_FLAG,
+        AMQP_BASIC_REPLY_TO_FLAG,
+        AMQP_BASIC_EXPIRATION_FLAG,
+        AMQP_BASIC_MESSAGE_ID_FLAG,
+        AMQP_BASIC_TIMESTAMP_FLAG,
+        AMQP_BASIC_TYPE_FLAG,
+        AMQP_BASIC_USER_ID_FLAG,
+        AMQP_BASIC_APP_ID_FLAG,
+        AMQP_BASIC_CLUSTER_ID_FLAG
+    };
+
+    const size_t field_count = sizeof field_order / sizeof field_order[0];
+
+    const amqp_flags_t patchable =
+            AMQP_BASIC_CORRELATION_ID_FLAG | AMQP_BASIC_MESSAGE_ID_FLAG |
+            AMQP_BASIC_TIMESTAMP_FLAG;
+
+    // class id, weight, body size
+    const size_t header_prefix_size = 12;
+    const size_t flags_size = 2;
+
+    // Encodes the properties selected by mask, without the flags word.
+    std::string encode_segment(const amqp_basic_properties_t& props,
+                               amqp_flags_t mask, size_t frame_max)
+    {
+        if(mask == 0)
+            return std::string();
+
+        amqp_basic_properties_t segment = props;
+        segment._flags = mask;
+
+        std::vector<char> buffer(frame_max);
+        amqp_bytes_t encoded;
+        encoded.bytes = &buffer[0];
+        encoded.len = buffer.size();
+
+        const int rc = amqp_encode_properties(AMQP_BASIC_CLASS, &segment,
+                                              encoded);
+        if(rc < 0)
+            throw std::runtime_error("Encoding publish template");
+        return std::string(&buffer[flags_size], rc - flags_size);
+    }
+
+    inline size_t shortstr_size(const amqp_bytes_t& value)
+    {
+        if(value.len > 255)
+            throw std::invalid_argument("short string longer than 255 bytes");
+        return 1 + value.len;
+    }
+
+    inline char* put_shortstr(char* out, const amqp_bytes_t& value)
+    {
+        put_u8(out, static_cast<uint8_t>(value.len));
+        memcpy(out + 1, value.bytes, value.len);
+        return out + 1 + value.len;
+    }
+}
+
+PublishTemplate::PublishTemplate(AmqpChannel& channel, PublishData& data,
+                                 amqp_flags_t varying):
+    channel_(channel),
+    static_size_(),
+    encoder_(channel.connection().frame_max())
+{
+    if(varying & ~patchable)
+        throw std::invalid_argument("field cannot vary in publish template");
+
+    amqp_basic_publish_t method;
+    method.ticket = 0;
+    method.exchange = data.exchange;
+    method.routing_key = data.routing_key;
+    method.mandatory = data.mandatory;
+    method.immediate = data.immediate;
+
+    encoder_.method(channel_.id(), AMQP_BASIC_PUBLISH_METHOD, &method);
+    method_frame_.assign(encoder_.data(), encoder_.size());
+    encoder_.clear();
+
+    const amqp_basic_properties_t props = data.message.properties;
+    flags_ = (props._flags & ~varying) | varying;
+
+    amqp_flags_t segment = 0;
+    for(size_t i = 0; i < field_count; ++i)
+    {
+        const amqp_flags_t field = field_order[i];
+        if(varying & field)
+        {
+            segments_.push_back(encode_segment(props, segment,
+                                               encoder_.frame_max()));
+            slots_.push_back(field);
+            segment = 0;
+        }
+        else if(flags_ & field)
+            segment |= field;
+    }
+    segments_.push_back(encode_segment(props, segment, encoder_.frame_max()));
+
+    for(size_t i = 0; i < segments_.size(); ++i)
+        static_size_ += segments_[i].size();
+
+    // building the cached frames above is not publishing
+    encoder_.metrics(channel.connection().metrics());
+}
+
+size_t PublishTemplate::header_payload_size(const PublishFields& fields) const
+{
+    size_t size = header_prefix_size + flags_size + static_size_;
+    for(size_t i = 0; i < slots_.size(); ++i)
+    {
+        switch(slots_[i])
+        {
+        case AMQP_BASIC_CORRELATION_ID_FLAG:
+            size += shortstr_size(fields.correlation_id);
+            break;
+
+        case AMQP_BASIC_MESSAGE_ID_FLAG:
+            size += shortstr_size(fields.message_id);
+            break;
+
+        case AMQP_BASIC_TIMESTAMP_FLAG:
+            size += 8;
+            break;
+        }
+    }
+    return size;
+}
+
+void PublishTemplate::encode(FrameEncoder& encoder, const amqp_bytes_t& body,
+                             const PublishFields& fields) const
+{
+    const size_t payload = header_payload_size(fields);
+    if(payload + FrameEncoder::frame_overhead > encoder.frame_max())
+        throw std::length_error("content header exceeds frame_max");
+
+    memcpy(encoder.extend(method_frame_.size()), method_frame_.data(),
+           method_frame_.size());
+
+    char* out = encoder.extend(payload + FrameEncoder::frame_overhead);
+    put_u8(out, AMQP_FRAME_HEADER);
+    put_u16(out + 1, channel_.id());
+    put_u32(out + 3, static_cast<uint32_t>(payload));
+    out += FrameEncoder::frame_header_size;
+
+    put_u16(out, AMQP_BASIC_CLASS);
+    put_u16(out + 2, 0); // weight
+    put_u64(out + 4, body.len);
+    put_u16(out + header_prefix_size, static_cast<uint16_t>(flags_));
+    out += header_prefix_size + flags_size;
+
+    for(size_t i = 0; i < segments_.size(); ++i)
+    {
+        const std::string& segment = segments_[i];
+        memcpy(out, segment.data(), segment.size());
+        out += segment.size();
+
+        if(i == slots_.size())
+            break;
+
+        switch(slots_[i])
+        {
+        case AMQP_BASIC_CORRELATION_ID_FLAG:
+            out = put_shortstr(out, fields.correlation_id);
+            break;
+
+        case AMQP_BASIC_MESSAGE_ID_FLAG:
+            out = put_shortstr(out, fields.message_id);
+            break;
+
+        case AMQP_BASIC_TIMESTAMP_FLAG:
+            put_u64(out, fields.timestamp);
+            out += 8;
+            break;
+        }
+    }
+    put_u8(out, AMQP_FRAME_END);
+    encoder.body(channel_.id(), body);
+}
+
+void PublishTemplate::publish(const amqp_bytes_t& body,
+                              const PublishFields& fields)
+{
+    encode(encoder_, body, fields);
+    const int rc = encoder_.send(channel_.connection());
+    check("Publishing", rc);
+}
@@ -0,0 +1,68 @@
+#ifndef AMQP_PUBLISH_TEMPLATE_HPP
+#define AMQP_PUBLISH_TEMPLATE_HPP
+
+#include <string>
+#include <vector>
+#include "amqp_channel.hpp"
+#include "amqp_encoder.hpp"
+
+// Per-message values patched into a PublishTemplate.
+struct PublishFields
+{
+    PublishFields():
+        correlation_id(amqp_empty_bytes),
+        message_id(amqp_empty_bytes),
+        timestamp()
+    {}
+
+    amqp_bytes_t correlation_id;
+    amqp_bytes_t message_id;
+    uint64_t timestamp;
+};
+
+// Pre-encoded basic.publish method frame and content header for a fixed
+// exchange, routing key and set of properties. The header is kept as
+// encoded segments between the per-message fields, so publishing a
+// message is a few memcpys plus the body frames. Varying fields are always
+// sent, empty if not given.
+class PublishTemplate: boost::noncopyable
+{
+public:
+    static const amqp_flags_t default_varying =
+            AMQP_BASIC_CORRELATION_ID_FLAG | AMQP_BASIC_MESSAGE_ID_FLAG |
+            AMQP_BASIC_TIMESTAMP_FLAG;
+
+    // Only correlation_id, message_id and timestamp may vary. The body of
+    // data is ignored.
+    PublishTemplate(AmqpChannel& channel, PublishData& data,
+                    amqp_flags_t varying = default_varying);
+
+    // The frames are for the template's channel.
+    amqp_channel_t channel_id() const
+    {
+        return channel_.id();
+    }
+
+    void encode(FrameEncoder& encoder, const amqp_bytes_t& body,
+                const PublishFields& fields = PublishFields()) const;
+
+    void publish(const amqp_bytes_t& body,
+                 const PublishFields& fields = PublishFields());
+
+private:
+    size_t header_payload_size(const PublishFields& fields) const;
+
+    AmqpChannel& channel_;
+    amqp_flags_t flags_;
+    std::string method_frame_;
+
+    // segments_[i] is followed by the field of slots_[i]; the last segment
+    // has no slot after it
+    std::vector<std::string> segments_;
+    std::vector<amqp_flags_t> slots_;
+    size_t static_size_;
+
+    FrameEncoder encoder_;
+};
+
+#endif // AMQP_PUBLISH_TEMPLATE_HPP
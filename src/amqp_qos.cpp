@@ -0,0 +1,71 @@
+#include "amqp_qos.hpp"
+#include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+    const double smoothing = 0.2;
+
+    inline double seconds(PrefetchController::Clock::duration d)
+    {
+        return boost::chrono::duration<double>(d).count();
+    }
+}
+
+PrefetchController::PrefetchController(AmqpChannel& channel,
+                                       uint16_t min_prefetch,
+                                       uint16_t max_prefetch,
+                                       Clock::duration buffer_time):
+    channel_(channel),
+    min_(std::max<uint16_t>(min_prefetch, 1)),
+    max_(std::max(min_, max_prefetch)),
+    buffer_time_(seconds(buffer_time)),
+    handler_time_(),
+    queue_depth_(),
+    queue_depth_known_(false),
+    prefetch_(min_)
+{
+    channel_.qos(QosData(prefetch_));
+}
+
+void PrefetchController::record(Clock::duration handler_time)
+{
+    const double sample = seconds(handler_time);
+    if(handler_time_ == 0)
+        handler_time_ = sample;
+    else
+        handler_time_ += smoothing * (sample - handler_time_);
+}
+
+void PrefetchController::queue_depth(uint32_t message_count)
+{
+    queue_depth_ = message_count;
+    queue_depth_known_ = true;
+}
+
+uint16_t PrefetchController::target() const
+{
+    double wanted = max_;
+    if(handler_time_ > 0)
+        wanted = buffer_time_ / handler_time_;
+
+    if(queue_depth_known_)
+        wanted = std::min(wanted, static_cast<double>(queue_depth_));
+
+    wanted = std::max(wanted, static_cast<double>(min_));
+    wanted = std::min(wanted, static_cast<double>(max_));
+    return static_cast<uint16_t>(wanted);
+}
+
+bool PrefetchController::adjust()
+{
+    const uint16_t wanted = target();
+    const int delta = std::abs(static_cast<int>(wanted) - prefetch_);
+
+    if(delta == 0 || delta * 4 < prefetch_)
+        return false;
+
+    channel_.qos(QosData(wanted));
+    prefetch_ = wanted;
+    return true;
+}
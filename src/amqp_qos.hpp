@@ -0,0 +1,48 @@
+#ifndef AMQP_QOS_HPP
+#define AMQP_QOS_HPP
+
+#include <boost/chrono.hpp>
+#include "amqp_channel.hpp"
+
+// Adjusts the channel's prefetch count from measured handler time and the
+// queue depth reported by the broker. The target is enough prefetched
+// messages to keep the handler busy for buffer_time, bounded by
+// [min_prefetch, max_prefetch] and by the queue depth, so a short queue is
+// shared with other consumers. Changes smaller than a quarter of the
+// current value are ignored to avoid sending basic.qos on every sample.
+class PrefetchController: boost::noncopyable
+{
+public:
+    typedef boost::chrono::steady_clock Clock;
+
+    PrefetchController(AmqpChannel& channel, uint16_t min_prefetch,
+                       uint16_t max_prefetch,
+                       Clock::duration buffer_time =
+                           boost::chrono::milliseconds(200));
+
+    void record(Clock::duration handler_time);
+    void queue_depth(uint32_t message_count);
+
+    // Recomputes the target and sends basic.qos if it moved enough.
+    // Returns true if the prefetch count was changed.
+    bool adjust();
+
+    uint16_t prefetch() const
+    {
+        return prefetch_;
+    }
+
+private:
+    uint16_t target() const;
+
+    AmqpChannel& channel_;
+    const uint16_t min_;
+    const uint16_t max_;
+    const double buffer_time_;
+    double handler_time_;
+    uint32_t queue_depth_;
+    bool queue_depth_known_;
+    uint16_t prefetch_;
+};
+
+#endif // AMQP_QOS_HPP
@@ -0,0 +1,685 @@
+#include "amqp_spool.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <boost/bind.hpp>
+#include <boost/move/unique_ptr.hpp>
+#include <boost/scope_exit.hpp>
+
+namespace
+{
+    const char segment_magic[] = "AMQPSPL1";
+    const size_t segment_header_size = 16;
+    const size_t max_iov = 64;
+
+    // Precedes the encoded frames of every entry. An entry with a zero size
+    // marks the end of a segment; ftruncate fills new segments with those.
+    // confirmed holds an EntryState, attempts the refusals so far.
+    struct EntryHeader
+    {
+        uint32_t size;
+        uint32_t checksum;
+        uint32_t confirmed;
+        uint32_t attempts;
+    };
+
+    inline size_t entry_size(size_t frames)
+    {
+        return sizeof(EntryHeader) + (frames + 7) / 8 * 8;
+    }
+
+    inline EntryHeader* entry_at(char* data, size_t offset)
+    {
+        return reinterpret_cast<EntryHeader*>(data + offset);
+    }
+
+    inline uint32_t checksum(const char* data, size_t size)
+    {
+        return crc32(0, reinterpret_cast<const Bytef*>(data), size);
+    }
+
+    std::string segment_path(const std::string& directory, uint64_t sequence)
+    {
+        char name[32];
+        snprintf(name, sizeof name, "%016llx.spool",
+                 static_cast<unsigned long long>(sequence));
+        return directory + "/" + name;
+    }
+
+    // Writes every buffer, resuming after partial writes.
+    int write_all(int sockfd, iovec* iov, size_t count)
+    {
+        while(count > 0)
+        {
+            msghdr message = msghdr();
+            message.msg_iov = iov;
+            message.msg_iovlen = count;
+
+            ssize_t sent = sendmsg(sockfd, &message, MSG_NOSIGNAL);
+            if(sent < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                return socket_error();
+            }
+
+            while(count > 0 && static_cast<size_t>(sent) >= iov->iov_len)
+            {
+                sent -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if(count > 0)
+            {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + sent;
+                iov->iov_len -= sent;
+            }
+        }
+        return 0;
+    }
+
+    inline bool is_method(const amqp_frame_t& frame, amqp_method_number_t id)
+    {
+        return frame.frame_type == AMQP_FRAME_METHOD &&
+                frame.payload.method.id == id;
+    }
+}
+
+PublishSpool::PublishSpool(const SpoolOptions& options,
+                           const ConnectionOptions& connection_options):
+    options_(options),
+    connection_options_(connection_options),
+    send_segment_(),
+    send_offset_(),
+    first_tag_(1),
+    heartbeat_(),
+    pending_(0),
+    connected_(false),
+    sleeping_(false),
+    stopped_(false),
+    wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    check_os("Creating spool wakeup event", wake_fd_);
+
+    try
+    {
+        if(mkdir(options_.directory.c_str(), 0755) < 0 && errno != EEXIST)
+            check_os("Creating spool directory", -1);
+
+        recover();
+        if(segments_.empty() || segments_.back()->sealed)
+        {
+            const uint64_t sequence = segments_.empty()
+                    ? 0 : segments_.back()->sequence + 1;
+            segments_.push_back(open_segment(sequence, options_.segment_size,
+                                             true));
+        }
+    }
+    catch(...)
+    {
+        for(size_t i = 0; i < segments_.size(); ++i)
+            close_segment(segments_[i], false);
+        close(wake_fd_);
+        throw;
+    }
+
+    thread_ = boost::thread(boost::bind(&PublishSpool::run, this));
+}
+
+PublishSpool::~PublishSpool()
+{
+    {
+        boost::mutex::scoped_lock lock(stop_mutex_);
+        stopped_ = true;
+        stop_requested_.notify_all();
+    }
+    const uint64_t one = 1;
+    if(write(wake_fd_, &one, sizeof one) < 0)
+    {} // the drainer polls with a timeout anyway
+    thread_.join();
+
+    for(size_t i = 0; i < segments_.size(); ++i)
+        close_segment(segments_[i], false);
+    close(wake_fd_);
+}
+
+void PublishSpool::recover()
+{
+    DIR* dir = opendir(options_.directory.c_str());
+    if(dir == 0)
+        check_os("Reading spool directory", -1);
+
+    std::vector<uint64_t> sequences;
+    while(dirent* entry = readdir(dir))
+    {
+        unsigned long long sequence;
+        char suffix[8];
+        if(sscanf(entry->d_name, "%16llx.%7s", &sequence, suffix) == 2 &&
+                strcmp(suffix, "spool") == 0)
+            sequences.push_back(sequence);
+    }
+    closedir(dir);
+    std::sort(sequences.begin(), sequences.end());
+
+    for(size_t i = 0; i < sequences.size(); ++i)
+    {
+        Segment* segment = open_segment(sequences[i], 0, false);
+        segment->sealed = i + 1 < sequences.size();
+
+        if(segment->sealed && segment->confirmed == segment->entries)
+        {
+            close_segment(segment, true);
+            continue;
+        }
+        segments_.push_back(segment);
+        pending_ += segment->entries - segment->confirmed;
+    }
+}
+
+PublishSpool::Segment* PublishSpool::open_segment(uint64_t sequence,
+                                                  size_t capacity, bool create)
+{
+    boost::movelib::unique_ptr<Segment> segment(new Segment());
+    segment->sequence = sequence;
+    segment->path = segment_path(options_.directory, sequence);
+    segment->size = segment_header_size;
+
+    const int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0);
+    const int fd = open(segment->path.c_str(), flags, 0644);
+    check_os("Opening spool segment", fd);
+
+    struct stat status = {};
+    const int rc = create ? ftruncate(fd, capacity) : fstat(fd, &status);
+    segment->capacity = create ? capacity : status.st_size;
+
+    void* data = MAP_FAILED;
+    if(rc == 0 && segment->capacity >= segment_header_size)
+        data = mmap(0, segment->capacity, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+    const int saved_errno = errno;
+    close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        if(create)
+            unlink(segment->path.c_str());
+        errno = saved_errno;
+        check_os("Mapping spool segment", -1);
+    }
+    segment->data = static_cast<char*>(data);
+
+    if(create)
+        memcpy(segment->data, segment_magic, sizeof segment_magic - 1);
+    else if(memcmp(segment->data, segment_magic, sizeof segment_magic - 1))
+    {
+        munmap(segment->data, segment->capacity);
+        throw std::runtime_error("Not a spool segment: " + segment->path);
+    }
+    else
+        scan(*segment);
+
+    return segment.release();
+}
+
+void PublishSpool::scan(Segment& segment)
+{
+    while(segment.size + sizeof(EntryHeader) <= segment.capacity)
+    {
+        EntryHeader* header = entry_at(segment.data, segment.size);
+        if(header->size == 0)
+            break;
+
+        const char* frames = segment.data + segment.size + sizeof(EntryHeader);
+        const bool complete =
+                segment.size + entry_size(header->size) <= segment.capacity &&
+                checksum(frames, header->size) == header->checksum;
+        if(!complete)
+        {
+            // torn by a crash in the middle of an append
+            memset(header, 0, sizeof(EntryHeader));
+            break;
+        }
+
+        ++segment.entries;
+        if(header->confirmed)
+            ++segment.confirmed;
+        segment.size += entry_size(header->size);
+    }
+}
+
+void PublishSpool::close_segment(Segment* segment, bool remove)
+{
+    munmap(segment->data, segment->capacity);
+    if(remove)
+        unlink(segment->path.c_str());
+    delete segment;
+}
+
+void PublishSpool::sync()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    for(size_t i = 0; i < segments_.size(); ++i)
+    {
+        const int rc = msync(segments_[i]->data, segments_[i]->size, MS_SYNC);
+        check_os("Syncing spool segment", rc);
+    }
+}
+
+void PublishSpool::publish(PublishData& data)
+{
+    FrameEncoder* encoder = encoders_.get();
+    if(encoder == 0)
+    {
+        encoder = new FrameEncoder(connection_options_.frame_max);
+        encoders_.reset(encoder);
+    }
+
+    amqp_basic_publish_t method;
+    method.ticket = 0;
+    method.exchange = data.exchange;
+    method.routing_key = data.routing_key;
+    method.mandatory = data.mandatory;
+    method.immediate = data.immediate;
+
+    const amqp_basic_properties_t properties = data.message.properties;
+    const amqp_bytes_t& body = data.message.body;
+
+    encoder->clear();
+    encoder->method(options_.channel, AMQP_BASIC_PUBLISH_METHOD, &method);
+    encoder->header(options_.channel, body.len, properties);
+    encoder->body(options_.channel, body);
+    append(encoder->data(), encoder->size());
+}
+
+void PublishSpool::append(const char* frames, size_t size)
+{
+    EntryHeader header = EntryHeader();
+    header.size = size;
+    header.checksum = checksum(frames, size);
+    const size_t needed = entry_size(size);
+
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        Segment* segment = segments_.back();
+        if(segment->size + needed > segment->capacity)
+        {
+            const size_t capacity = std::max(options_.segment_size,
+                                             segment_header_size + needed);
+            Segment* next = open_segment(segment->sequence + 1, capacity,
+                                         true);
+            segment->sealed = true;
+            segments_.push_back(next);
+            segment = next;
+        }
+
+        char* out = segment->data + segment->size;
+        memcpy(out + sizeof header, frames, size);
+        memcpy(out, &header, sizeof header);
+        segment->size += needed;
+        ++segment->entries;
+    }
+    ++pending_;
+
+    // the drainer checks for entries after announcing that it sleeps
+    if(sleeping_.load())
+    {
+        const uint64_t one = 1;
+        if(write(wake_fd_, &one, sizeof one) < 0)
+        {} // already signalled
+    }
+}
+
+void PublishSpool::run()
+{
+    while(!stopped_)
+    {
+        try
+        {
+            drain();
+        }
+        catch(const std::exception& e)
+        {
+            report(e.what());
+        }
+
+        boost::mutex::scoped_lock lock(stop_mutex_);
+        if(!stopped_)
+            stop_requested_.timed_wait(
+                        lock, boost::posix_time::milliseconds(options_.retry_ms));
+    }
+}
+
+void PublishSpool::report(const std::string& error)
+{
+    {
+        boost::mutex::scoped_lock lock(error_mutex_);
+        last_error_ = error;
+    }
+    if(options_.on_error)
+        options_.on_error(error);
+}
+
+std::string PublishSpool::last_error() const
+{
+    boost::mutex::scoped_lock lock(error_mutex_);
+    return last_error_;
+}
+
+void PublishSpool::rewind()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    in_flight_.clear();
+    first_tag_ = 1;
+    send_segment_ = segments_.front();
+    send_offset_ = segment_header_size;
+}
+
+void PublishSpool::drain()
+{
+    // wait_for_work() sends the heartbeats
+    ConnectionOptions options = connection_options_;
+    options.heartbeat_driven = true;
+
+    AmqpConnection conn(options);
+    AmqpChannel channel(conn, options_.channel);
+    if(conn.frame_max() < connection_options_.frame_max)
+        throw std::runtime_error("broker lowered frame_max below the one "
+                                 "spooled messages are encoded for");
+
+    channel.confirm_select();
+    rewind();
+    heartbeat_ = boost::chrono::seconds(conn.heartbeat());
+    last_sent_ = last_received_ = Clock::now();
+    {
+        boost::mutex::scoped_lock lock(error_mutex_);
+        last_error_.clear();
+    }
+
+    connected_ = true;
+    BOOST_SCOPE_EXIT(&connected_) {
+        connected_ = false;
+    } BOOST_SCOPE_EXIT_END
+
+    while(!stopped_)
+    {
+        if(in_flight_.size() < options_.max_in_flight)
+            send_entries(conn.sockfd());
+        wait_for_work(conn);
+        keep_alive(conn);
+    }
+}
+
+bool PublishSpool::has_unsent()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return send_offset_ < send_segment_->size || send_segment_->sealed;
+}
+
+size_t PublishSpool::send_entries(int sockfd)
+{
+    iovec iov[max_iov];
+    size_t count = 0;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        while(count < max_iov &&
+              in_flight_.size() < options_.max_in_flight)
+        {
+            if(send_offset_ >= send_segment_->size)
+            {
+                if(!send_segment_->sealed)
+                    break;
+
+                // recovery may leave gaps in the sequence numbers
+                std::deque<Segment*>::iterator it = std::find(
+                            segments_.begin(), segments_.end(), send_segment_);
+                send_segment_ = *++it;
+                send_offset_ = segment_header_size;
+                continue;
+            }
+
+            const size_t offset = send_offset_;
+            EntryHeader* header = entry_at(send_segment_->data, offset);
+            send_offset_ += entry_size(header->size);
+            if(header->confirmed)
+                continue;
+
+            // entries are never moved while the segment exists, and only
+            // this thread deletes segments
+            iov[count].iov_base = send_segment_->data + offset +
+                    sizeof(EntryHeader);
+            iov[count].iov_len = header->size;
+            ++count;
+
+            InFlight entry;
+            entry.segment = send_segment_;
+            entry.offset = offset;
+            entry.done = false;
+            in_flight_.push_back(entry);
+        }
+    }
+
+    if(count > 0)
+    {
+        check("Sending spooled messages", write_all(sockfd, iov, count));
+        last_sent_ = Clock::now();
+    }
+    return count;
+}
+
+void PublishSpool::wait_for_work(AmqpConnection& conn)
+{
+    if(amqp_frames_enqueued(conn) || amqp_data_in_buffer(conn))
+        return read_frames(conn);
+
+    // an append between the check and poll() finds sleeping_ set and
+    // signals the wakeup event
+    const bool window_open = in_flight_.size() < options_.max_in_flight;
+    sleeping_ = window_open;
+    if(window_open && has_unsent())
+    {
+        sleeping_ = false;
+        return;
+    }
+
+    pollfd fds[2];
+    fds[0].fd = conn.sockfd();
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd_;
+    fds[1].events = POLLIN;
+
+    int timeout_ms = 1000;
+    if(heartbeat_ > Clock::duration::zero())
+    {
+        using namespace boost::chrono;
+        const Clock::time_point due = std::min(last_sent_ + heartbeat_ / 2,
+                                               last_received_ + 2 * heartbeat_);
+        const Clock::duration left = due - Clock::now();
+        timeout_ms = left > Clock::duration::zero()
+                ? static_cast<int>(ceil<milliseconds>(left).count()) : 0;
+    }
+
+    const int rc = poll(fds, 2, timeout_ms);
+    sleeping_ = false;
+    if(rc < 0 && errno != EINTR)
+        check_os("Waiting for confirms", rc);
+
+    if(rc > 0 && (fds[1].revents & POLLIN))
+    {
+        uint64_t value;
+        if(read(wake_fd_, &value, sizeof value) < 0)
+        {} // drained by an earlier wakeup
+    }
+
+    if(rc > 0 && fds[0].revents != 0)
+        read_frames(conn);
+}
+
+// Like AmqpEventLoop::run_timers: the broker's own heartbeats wake poll()
+// before it times out, so the heartbeat is paced by the last send.
+void PublishSpool::keep_alive(AmqpConnection& conn)
+{
+    if(heartbeat_ == Clock::duration::zero())
+        return;
+
+    const Clock::time_point now = Clock::now();
+    if(now - last_received_ > 2 * heartbeat_)
+        check("Broker heartbeat", os_error(ETIMEDOUT));
+
+    if(now - last_sent_ >= heartbeat_ / 2)
+    {
+        amqp_frame_t frame = amqp_frame_t();
+        frame.frame_type = AMQP_FRAME_HEARTBEAT;
+        frame.channel = 0;
+        check("Sending heartbeat", amqp_send_frame(conn, &frame));
+        last_sent_ = now;
+    }
+}
+
+void PublishSpool::read_frames(AmqpConnection& conn)
+{
+    do
+    {
+        amqp_frame_t frame;
+        check("Reading confirms", conn.wait_frame(frame));
+
+        if(is_method(frame, AMQP_BASIC_ACK_METHOD))
+        {
+            const amqp_basic_ack_t* ack = static_cast<const amqp_basic_ack_t*>(
+                        frame.payload.method.decoded);
+            confirm(ack->delivery_tag, ack->multiple, true);
+        }
+        else if(is_method(frame, AMQP_BASIC_NACK_METHOD))
+        {
+            const amqp_basic_nack_t* nack =
+                    static_cast<const amqp_basic_nack_t*>(
+                        frame.payload.method.decoded);
+            confirm(nack->delivery_tag, nack->multiple, false);
+        }
+        else if(is_method(frame, AMQP_CHANNEL_CLOSE_METHOD) ||
+                is_method(frame, AMQP_CONNECTION_CLOSE_METHOD))
+        {
+            amqp_rpc_reply_t reply = amqp_rpc_reply_t();
+            reply.reply_type = AMQP_RESPONSE_SERVER_EXCEPTION;
+            reply.reply = frame.payload.method;
+            const AmqpRpcError error("Spool connection closed", reply);
+            const bool channel_closed =
+                    is_method(frame, AMQP_CHANNEL_CLOSE_METHOD);
+            conn.release_buffers();
+
+            // the broker closes the channel on the first publish it
+            // refuses; the oldest unconfirmed one is the best guess
+            if(channel_closed && !in_flight_.empty())
+            {
+                refuse(in_flight_.front(), error.what());
+                remove_confirmed();
+            }
+            throw error;
+        }
+        conn.release_buffers();
+    }
+    while(amqp_frames_enqueued(conn) || amqp_data_in_buffer(conn));
+
+    last_received_ = Clock::now();
+    remove_confirmed();
+}
+
+void PublishSpool::confirm(uint64_t delivery_tag, bool multiple, bool acked)
+{
+    const uint64_t next_tag = first_tag_ + in_flight_.size();
+    if(delivery_tag < first_tag_ || delivery_tag >= next_tag)
+    {
+        // tag 0 with multiple set confirms everything outstanding
+        if(!(multiple && delivery_tag == 0))
+            return;
+        delivery_tag = next_tag - 1;
+    }
+
+    const size_t index = delivery_tag - first_tag_;
+    bool resend = false;
+    for(size_t i = multiple ? 0 : index; i <= index; ++i)
+    {
+        InFlight& entry = in_flight_[i];
+        if(acked)
+            complete(entry, entry_confirmed);
+        else if(!entry.done)
+        {
+            refuse(entry, "broker nacked a spooled message");
+            resend = resend || !entry.done;
+        }
+    }
+
+    while(!in_flight_.empty() && in_flight_.front().done)
+    {
+        in_flight_.pop_front();
+        ++first_tag_;
+    }
+
+    // resent after reconnecting
+    if(resend)
+    {
+        remove_confirmed();
+        throw std::runtime_error("broker nacked a spooled message");
+    }
+}
+
+void PublishSpool::refuse(InFlight& entry, const std::string& reason)
+{
+    if(entry.done)
+        return;
+
+    EntryHeader* header = entry_at(entry.segment->data, entry.offset);
+    ++header->attempts;
+    if(options_.max_attempts == 0 || header->attempts < options_.max_attempts)
+        return;
+
+    if(options_.on_dead)
+    {
+        amqp_bytes_t frames;
+        frames.bytes = entry.segment->data + entry.offset + sizeof(EntryHeader);
+        frames.len = header->size;
+        options_.on_dead(frames, reason);
+    }
+    complete(entry, entry_dead);
+}
+
+void PublishSpool::complete(InFlight& entry, EntryState state)
+{
+    if(entry.done)
+        return;
+
+    entry.done = true;
+    entry_at(entry.segment->data, entry.offset)->confirmed = state;
+    ++entry.segment->confirmed;
+    --pending_;
+}
+
+void PublishSpool::remove_confirmed()
+{
+    std::vector<Segment*> removed;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        while(segments_.front() != send_segment_)
+        {
+            Segment* segment = segments_.front();
+            if(segment->confirmed != segment->entries)
+                break;
+            segments_.pop_front();
+            removed.push_back(segment);
+        }
+    }
+
+    for(size_t i = 0; i < removed.size(); ++i)
+        close_segment(removed[i], true);
+}
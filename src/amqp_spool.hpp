@@ -0,0 +1,180 @@
+#ifndef AMQP_SPOOL_HPP
+#define AMQP_SPOOL_HPP
+
+#include <deque>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include "amqp_channel.hpp"
+#include "amqp_encoder.hpp"
+
+// Called on the drainer thread; must not throw.
+typedef boost::function<void (const std::string& error)> SpoolErrorHandler;
+typedef boost::function<void (const amqp_bytes_t& frames,
+                              const std::string& reason)> DeadEntryHandler;
+
+struct SpoolOptions
+{
+    explicit SpoolOptions(const std::string& dir):
+        directory(dir),
+        segment_size(64 << 20),
+        max_in_flight(1024),
+        channel(1),
+        retry_ms(1000),
+        max_attempts(5)
+    {}
+
+    std::string directory; // created if missing
+    size_t segment_size; // bytes per segment file
+    size_t max_in_flight; // unconfirmed publishes on the wire
+    amqp_channel_t channel;
+    int retry_ms; // wait before reconnecting
+    unsigned max_attempts; // refusals before an entry is dead, 0: no limit
+
+    SpoolErrorHandler on_error; // every failed drain attempt
+    DeadEntryHandler on_dead; // the encoded frames of a dead entry
+};
+
+// Publishing that does not wait for the broker. publish() encodes the
+// message and appends the frames to a log of memory-mapped segment files,
+// without any network I/O. A background thread keeps its own connection
+// to the broker, sends the logged frames on a channel in confirm mode and
+// marks entries confirmed in place; segments whose entries are all
+// confirmed are deleted. When the broker fails, nacks or is unreachable,
+// the drainer reconnects after retry_ms and resends every unconfirmed
+// entry, and a spool opened on an existing directory does the same with
+// whatever a crashed process left behind. Delivery is therefore at least
+// once. Each failed attempt goes to on_error and last_error(). With a
+// heartbeat in the connection options, the drainer sends one whenever it
+// sent nothing for half the interval, and treats a broker silent for two
+// intervals as lost.
+//
+// A message the broker always refuses, e.g. one published to a missing
+// exchange, would otherwise hold up everything behind it. A nack counts as
+// a refusal of the nacked entries, and a channel.close as a refusal of the
+// oldest unconfirmed entry, which is the one the broker failed on unless
+// earlier confirms were still outstanding. The count is kept in the log.
+// After max_attempts refusals the entry is dead: it is handed to on_dead,
+// marked settled and never sent again. Lost connections count against no
+// entry.
+//
+// Entries survive a crash of the process as soon as publish() returns;
+// call sync() to also survive a crash of the machine. Messages are encoded
+// for the frame_max in the connection options, which the broker must
+// accept. Only one spool may use a directory at a time.
+class PublishSpool: boost::noncopyable
+{
+public:
+    PublishSpool(const SpoolOptions& options,
+                 const ConnectionOptions& connection_options);
+
+    // Safe to call from any thread; throws only when the log cannot be
+    // written.
+    void publish(PublishData& data);
+
+    // Entries appended but not yet confirmed by the broker.
+    size_t pending() const
+    {
+        return pending_.load(boost::memory_order_relaxed);
+    }
+
+    bool connected() const
+    {
+        return connected_.load(boost::memory_order_relaxed);
+    }
+
+    // Why the last drain attempt failed; empty once connected again.
+    std::string last_error() const;
+
+    // Flushes the segments to disk.
+    void sync();
+
+    // Stops the drainer; unconfirmed entries stay in the log for the next
+    // spool opened on the directory.
+    ~PublishSpool();
+
+private:
+    struct Segment
+    {
+        uint64_t sequence;
+        std::string path;
+        char* data;
+        size_t capacity;
+        size_t size; // end of the last entry
+        size_t entries;
+        size_t confirmed; // drainer only
+        bool sealed;
+    };
+
+    typedef boost::chrono::steady_clock Clock;
+
+    struct InFlight
+    {
+        Segment* segment;
+        size_t offset;
+        bool done;
+    };
+
+    enum EntryState
+    {
+        entry_pending,
+        entry_confirmed,
+        entry_dead
+    };
+
+    void recover();
+    Segment* open_segment(uint64_t sequence, size_t capacity, bool create);
+    void scan(Segment& segment);
+    void close_segment(Segment* segment, bool remove);
+    void append(const char* frames, size_t size);
+
+    void run();
+    void drain();
+    void rewind();
+    size_t send_entries(int sockfd);
+    bool has_unsent();
+    void wait_for_work(AmqpConnection& conn);
+    void keep_alive(AmqpConnection& conn);
+    void read_frames(AmqpConnection& conn);
+    void confirm(uint64_t delivery_tag, bool multiple, bool acked);
+    void refuse(InFlight& entry, const std::string& reason);
+    void complete(InFlight& entry, EntryState state);
+    void remove_confirmed();
+    void report(const std::string& error);
+
+    const SpoolOptions options_;
+    const ConnectionOptions connection_options_;
+    boost::thread_specific_ptr<FrameEncoder> encoders_;
+
+    // guarded by mutex_
+    boost::mutex mutex_;
+    std::deque<Segment*> segments_;
+    Segment* send_segment_;
+    size_t send_offset_;
+
+    // drainer only
+    std::deque<InFlight> in_flight_;
+    uint64_t first_tag_;
+    Clock::duration heartbeat_;
+    Clock::time_point last_sent_;
+    Clock::time_point last_received_;
+
+    mutable boost::mutex error_mutex_;
+    std::string last_error_;
+
+    boost::atomic<size_t> pending_;
+    boost::atomic<bool> connected_;
+    boost::atomic<bool> sleeping_;
+    boost::atomic<bool> stopped_;
+    int wake_fd_;
+    boost::mutex stop_mutex_;
+    boost::condition_variable stop_requested_;
+    boost::thread thread_;
+};
+
+#endif // AMQP_SPOOL_HPP
@@ -0,0 +1,196 @@
+#include "amqp_table_view.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    inline uint32_t hash(const amqp_bytes_t& key)
+    {
+        // FNV-1a
+        uint32_t result = 2166136261u;
+        const unsigned char* bytes =
+                static_cast<const unsigned char*>(key.bytes);
+        for(size_t i = 0; i < key.len; ++i)
+        {
+            result ^= bytes[i];
+            result *= 16777619u;
+        }
+        return result;
+    }
+
+    inline bool equal(const amqp_bytes_t& a, const amqp_bytes_t& b)
+    {
+        return a.len == b.len && memcmp(a.bytes, b.bytes, a.len) == 0;
+    }
+
+    inline void expect(bool matches)
+    {
+        if(!matches)
+            throw std::runtime_error("field kind mismatch");
+    }
+}
+
+bool AmqpFieldView::is_integer() const
+{
+    switch(kind())
+    {
+    case AMQP_FIELD_KIND_I8:
+    case AMQP_FIELD_KIND_U8:
+    case AMQP_FIELD_KIND_I16:
+    case AMQP_FIELD_KIND_U16:
+    case AMQP_FIELD_KIND_I32:
+    case AMQP_FIELD_KIND_U32:
+    case AMQP_FIELD_KIND_I64:
+    case AMQP_FIELD_KIND_U64:
+    case AMQP_FIELD_KIND_TIMESTAMP:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool AmqpFieldView::is_floating() const
+{
+    return kind() == AMQP_FIELD_KIND_F32 || kind() == AMQP_FIELD_KIND_F64;
+}
+
+bool AmqpFieldView::is_bytes() const
+{
+    return kind() == AMQP_FIELD_KIND_BYTES || kind() == AMQP_FIELD_KIND_UTF8;
+}
+
+bool AmqpFieldView::boolean() const
+{
+    expect(kind() == AMQP_FIELD_KIND_BOOLEAN);
+    return value_->value.boolean != 0;
+}
+
+int64_t AmqpFieldView::integer() const
+{
+    const amqp_field_value_t& value = *value_;
+    switch(kind())
+    {
+    case AMQP_FIELD_KIND_I8:
+        return value.value.i8;
+
+    case AMQP_FIELD_KIND_U8:
+        return value.value.u8;
+
+    case AMQP_FIELD_KIND_I16:
+        return value.value.i16;
+
+    case AMQP_FIELD_KIND_U16:
+        return value.value.u16;
+
+    case AMQP_FIELD_KIND_I32:
+        return value.value.i32;
+
+    case AMQP_FIELD_KIND_U32:
+        return value.value.u32;
+
+    case AMQP_FIELD_KIND_I64:
+        return value.value.i64;
+
+    case AMQP_FIELD_KIND_U64:
+    case AMQP_FIELD_KIND_TIMESTAMP:
+        return static_cast<int64_t>(value.value.u64);
+
+    default:
+        expect(false);
+        return 0;
+    }
+}
+
+double AmqpFieldView::floating() const
+{
+    expect(is_floating());
+    return kind() == AMQP_FIELD_KIND_F32 ? value_->value.f32
+                                         : value_->value.f64;
+}
+
+const amqp_bytes_t& AmqpFieldView::bytes() const
+{
+    expect(is_bytes());
+    return value_->value.bytes;
+}
+
+std::string AmqpFieldView::string() const
+{
+    const amqp_bytes_t& value = bytes();
+    return std::string(static_cast<const char*>(value.bytes), value.len);
+}
+
+AmqpTableView AmqpFieldView::table() const
+{
+    expect(kind() == AMQP_FIELD_KIND_TABLE);
+    return AmqpTableView(value_->value.table);
+}
+
+AmqpArrayView AmqpFieldView::array() const
+{
+    expect(kind() == AMQP_FIELD_KIND_ARRAY);
+    return AmqpArrayView(value_->value.array);
+}
+
+void AmqpTableView::build_index() const
+{
+    size_t slots = 16;
+    while(slots < 2 * size())
+        slots <<= 1;
+
+    index_.assign(slots, 0);
+    const size_t mask = slots - 1;
+
+    for(size_t i = 0; i < size(); ++i)
+    {
+        size_t slot = hash(key(i)) & mask;
+        while(index_[slot] != 0 && !equal(key(index_[slot] - 1), key(i)))
+            slot = (slot + 1) & mask;
+
+        if(index_[slot] == 0)
+            index_[slot] = i + 1;
+    }
+}
+
+AmqpFieldView AmqpTableView::find(const amqp_bytes_t& name) const
+{
+    if(size() <= index_threshold)
+    {
+        for(size_t i = 0; i < size(); ++i)
+        {
+            if(equal(key(i), name))
+                return value(i);
+        }
+        return AmqpFieldView();
+    }
+
+    if(index_.empty())
+        build_index();
+
+    const size_t mask = index_.size() - 1;
+    for(size_t slot = hash(name) & mask; index_[slot] != 0;
+        slot = (slot + 1) & mask)
+    {
+        const size_t i = index_[slot] - 1;
+        if(equal(key(i), name))
+            return value(i);
+    }
+    return AmqpFieldView();
+}
+
+AmqpFieldView AmqpTableView::find(const char* name) const
+{
+    amqp_bytes_t bytes;
+    bytes.bytes = const_cast<char*>(name);
+    bytes.len = strlen(name);
+    return find(bytes);
+}
+
+AmqpFieldView AmqpTableView::find(const std::string& name) const
+{
+    amqp_bytes_t bytes;
+    bytes.bytes = const_cast<char*>(name.data());
+    bytes.len = name.size();
+    return find(bytes);
+}
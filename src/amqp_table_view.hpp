@@ -0,0 +1,139 @@
+#ifndef AMQP_TABLE_VIEW_HPP
+#define AMQP_TABLE_VIEW_HPP
+
+#include <string>
+#include <vector>
+#include <amqp.h>
+
+class AmqpTableView;
+class AmqpArrayView;
+
+// Non-owning view of one decoded field value. Nested tables and arrays are
+// returned as views too, so nothing is copied until the caller asks for a
+// std::string. A default-constructed view stands for a missing field.
+class AmqpFieldView
+{
+public:
+    AmqpFieldView():
+        value_()
+    {}
+
+    explicit AmqpFieldView(const amqp_field_value_t& value):
+        value_(&value)
+    {}
+
+    bool valid() const
+    {
+        return value_ != 0;
+    }
+
+    uint8_t kind() const
+    {
+        return value_ != 0 ? value_->kind : uint8_t(AMQP_FIELD_KIND_VOID);
+    }
+
+    const amqp_field_value_t& data() const
+    {
+        return *value_;
+    }
+
+    bool is_integer() const;
+    bool is_floating() const;
+    bool is_bytes() const;
+
+    // The accessors throw std::runtime_error if the kind does not match;
+    // integer() accepts every integer kind, floating() both float kinds.
+    bool boolean() const;
+    int64_t integer() const;
+    double floating() const;
+    const amqp_bytes_t& bytes() const;
+    std::string string() const;
+    AmqpTableView table() const;
+    AmqpArrayView array() const;
+
+private:
+    const amqp_field_value_t* value_;
+};
+
+class AmqpArrayView
+{
+public:
+    AmqpArrayView():
+        array_()
+    {}
+
+    explicit AmqpArrayView(const amqp_array_t& array):
+        array_(array)
+    {}
+
+    size_t size() const
+    {
+        return array_.num_entries;
+    }
+
+    AmqpFieldView operator[](size_t i) const
+    {
+        return AmqpFieldView(array_.entries[i]);
+    }
+
+private:
+    amqp_array_t array_;
+};
+
+// Non-owning view of a decoded header table, valid as long as the table
+// is (for consumed messages, until AmqpConnection::release_buffers()).
+// Small tables are searched linearly; tables with more than
+// index_threshold entries get an open-addressing hash index on the first
+// keyed lookup. As with a linear scan, the first of duplicate keys wins.
+class AmqpTableView
+{
+public:
+    static const size_t index_threshold = 8;
+
+    AmqpTableView():
+        table_()
+    {}
+
+    explicit AmqpTableView(const amqp_table_t& table):
+        table_(table)
+    {}
+
+    size_t size() const
+    {
+        return table_.num_entries;
+    }
+
+    bool empty() const
+    {
+        return table_.num_entries == 0;
+    }
+
+    const amqp_bytes_t& key(size_t i) const
+    {
+        return table_.entries[i].key;
+    }
+
+    AmqpFieldView value(size_t i) const
+    {
+        return AmqpFieldView(table_.entries[i].value);
+    }
+
+    AmqpFieldView find(const amqp_bytes_t& key) const;
+    AmqpFieldView find(const char* key) const;
+    AmqpFieldView find(const std::string& key) const;
+
+    AmqpFieldView operator[](const char* key) const
+    {
+        return find(key);
+    }
+
+private:
+    void build_index() const;
+
+    amqp_table_t table_;
+
+    // slot holds entry index + 1, 0 when empty; size is a power of two
+    mutable std::vector<uint32_t> index_;
+};
+
+#endif // AMQP_TABLE_VIEW_HPP
@@ -0,0 +1,284 @@
+#include "amqp_topology.hpp"
+#include <deque>
+#include "amqp_encoder.hpp"
+
+namespace
+{
+    inline bool empty(const AmqpBytes& bytes)
+    {
+        return bytes.data().len == 0;
+    }
+
+    template<typename T> inline const T* decoded(const amqp_frame_t& frame)
+    {
+        return static_cast<const T*>(frame.payload.method.decoded);
+    }
+}
+
+Topology::Topology():
+    queues_(),
+    consumers_()
+{}
+
+void Topology::exchange(const ExchangeData& data)
+{
+    Declaration declaration(exchange_declare);
+    declaration.name = data.exchange;
+    declaration.target = data.type;
+    declaration.passive = data.passive;
+    declaration.durable = data.durable;
+    declaration.auto_delete = data.auto_delete;
+    declaration.internal = data.internal;
+    declaration.arguments = AmqpTable(data.arguments);
+    declarations_.push_back(declaration);
+}
+
+void Topology::queue(const QueueData& data)
+{
+    Declaration declaration(queue_declare);
+    declaration.name = data.queue;
+    declaration.passive = data.passive;
+    declaration.durable = data.durable;
+    declaration.exclusive = data.exclusive;
+    declaration.auto_delete = data.auto_delete;
+    declaration.arguments = AmqpTable(data.arguments);
+    declaration.result_index = queues_++;
+    declarations_.push_back(declaration);
+}
+
+void Topology::bind(const BindData& data)
+{
+    Declaration declaration(queue_bind);
+    declaration.name = data.queue;
+    declaration.target = data.exchange;
+    declaration.routing_key = data.routing_key;
+    declaration.arguments = AmqpTable(data.arguments);
+    declarations_.push_back(declaration);
+}
+
+void Topology::qos(const QosData& data)
+{
+    Declaration declaration(basic_qos);
+    declaration.prefetch_size = data.prefetch_size;
+    declaration.prefetch_count = data.prefetch_count;
+    declaration.global = data.global;
+    declarations_.push_back(declaration);
+}
+
+void Topology::consume(const ConsumeData& data)
+{
+    Declaration declaration(basic_consume);
+    declaration.name = data.queue;
+    declaration.target = data.consumer_tag;
+    declaration.no_local = data.no_local;
+    declaration.no_ack = data.no_ack;
+    declaration.exclusive = data.exclusive;
+    declaration.arguments = AmqpTable(data.arguments);
+    declaration.result_index = consumers_++;
+    declarations_.push_back(declaration);
+}
+
+Topology::Reply Topology::encode(Declaration& declaration,
+                                 amqp_channel_t channel, FrameEncoder& encoder)
+{
+    Reply reply;
+    reply.id = 0;
+    reply.declaration = &declaration;
+
+    switch(declaration.kind)
+    {
+    case exchange_declare:
+        {
+            amqp_exchange_declare_t method;
+            method.ticket = 0;
+            method.exchange = declaration.name;
+            method.type = declaration.target;
+            method.passive = declaration.passive;
+            method.durable = declaration.durable;
+            method.auto_delete = declaration.auto_delete;
+            method.internal = declaration.internal;
+            method.nowait = 1;
+            method.arguments = declaration.arguments;
+            encoder.method(channel, AMQP_EXCHANGE_DECLARE_METHOD, &method);
+        }
+        break;
+
+    case queue_declare:
+        {
+            // only the reply names a server-named queue
+            const bool wait = empty(declaration.name);
+
+            amqp_queue_declare_t method;
+            method.ticket = 0;
+            method.queue = declaration.name;
+            method.passive = declaration.passive;
+            method.durable = declaration.durable;
+            method.exclusive = declaration.exclusive;
+            method.auto_delete = declaration.auto_delete;
+            method.nowait = !wait;
+            method.arguments = declaration.arguments;
+            encoder.method(channel, AMQP_QUEUE_DECLARE_METHOD, &method);
+
+            if(wait)
+                reply.id = AMQP_QUEUE_DECLARE_OK_METHOD;
+            else
+                queue_names_[declaration.result_index] =
+                        from_amqp_bytes<std::string>(declaration.name);
+        }
+        break;
+
+    case queue_bind:
+        {
+            amqp_queue_bind_t method;
+            method.ticket = 0;
+            method.queue = declaration.name;
+            method.exchange = declaration.target;
+            method.routing_key = declaration.routing_key;
+            method.nowait = 1;
+            method.arguments = declaration.arguments;
+            encoder.method(channel, AMQP_QUEUE_BIND_METHOD, &method);
+        }
+        break;
+
+    case basic_qos:
+        {
+            // basic.qos has no nowait flag
+            amqp_basic_qos_t method;
+            method.prefetch_size = declaration.prefetch_size;
+            method.prefetch_count = declaration.prefetch_count;
+            method.global = declaration.global;
+            encoder.method(channel, AMQP_BASIC_QOS_METHOD, &method);
+            reply.id = AMQP_BASIC_QOS_OK_METHOD;
+        }
+        break;
+
+    case basic_consume:
+        {
+            // only the reply names a consumer without a tag
+            const bool wait = empty(declaration.target);
+
+            amqp_basic_consume_t method;
+            method.ticket = 0;
+            method.queue = declaration.name;
+            method.consumer_tag = declaration.target;
+            method.no_local = declaration.no_local;
+            method.no_ack = declaration.no_ack;
+            method.exclusive = declaration.exclusive;
+            method.nowait = !wait;
+            method.arguments = declaration.arguments;
+            encoder.method(channel, AMQP_BASIC_CONSUME_METHOD, &method);
+
+            if(wait)
+                reply.id = AMQP_BASIC_CONSUME_OK_METHOD;
+            else
+                consumer_tags_[declaration.result_index] =
+                        from_amqp_bytes<std::string>(declaration.target);
+        }
+        break;
+    }
+    return reply;
+}
+
+void Topology::complete(const Reply& reply, const amqp_frame_t& frame)
+{
+    if(reply.declaration == 0)
+        return;
+
+    const size_t index = reply.declaration->result_index;
+    if(reply.id == AMQP_QUEUE_DECLARE_OK_METHOD)
+    {
+        const amqp_queue_declare_ok_t* ok =
+                decoded<amqp_queue_declare_ok_t>(frame);
+        queue_names_[index] = from_amqp_bytes<std::string>(ok->queue);
+    }
+    else if(reply.id == AMQP_BASIC_CONSUME_OK_METHOD)
+    {
+        const amqp_basic_consume_ok_t* ok =
+                decoded<amqp_basic_consume_ok_t>(frame);
+        consumer_tags_[index] = from_amqp_bytes<std::string>(ok->consumer_tag);
+    }
+}
+
+void Topology::apply(AmqpChannel& channel)
+{
+    AmqpConnection& conn = channel.connection();
+    const amqp_channel_t id = channel.id();
+
+    FrameEncoder encoder(conn.frame_max());
+    encoder.metrics(conn.metrics());
+    queue_names_.assign(queues_, std::string());
+    consumer_tags_.assign(consumers_, std::string());
+    early_frames_.clear();
+
+    std::deque<Reply> replies;
+    for(size_t i = 0; i < declarations_.size(); ++i)
+    {
+        const Reply reply = encode(declarations_[i], id, encoder);
+        if(reply.id != 0)
+            replies.push_back(reply);
+    }
+
+    // a nowait declaration that fails closes the channel, so the reply to
+    // this comes only if all of them succeeded
+    amqp_exchange_declare_t check_method = amqp_exchange_declare_t();
+    check_method.exchange = amqp_cstring_bytes("amq.direct");
+    check_method.type = amqp_cstring_bytes("direct");
+    check_method.passive = 1;
+    check_method.arguments = amqp_empty_table;
+    encoder.method(id, AMQP_EXCHANGE_DECLARE_METHOD, &check_method);
+
+    Reply final_check;
+    final_check.id = AMQP_EXCHANGE_DECLARE_OK_METHOD;
+    final_check.declaration = 0;
+    replies.push_back(final_check);
+
+    check("Declaring topology", encoder.send(conn));
+
+    // frames given to the handler live in the connection's buffers too
+    bool handed_out = false;
+    amqp_frame_t frame;
+    while(!replies.empty())
+    {
+        check("Waiting for topology replies", conn.wait_frame(frame));
+
+        const bool method = frame.frame_type == AMQP_FRAME_METHOD;
+        const amqp_method_number_t method_id = frame.payload.method.id;
+        if(method && (method_id == AMQP_CONNECTION_CLOSE_METHOD ||
+                      (frame.channel == id &&
+                       method_id == AMQP_CHANNEL_CLOSE_METHOD)))
+        {
+            amqp_rpc_reply_t reply = amqp_rpc_reply_t();
+            reply.reply_type = AMQP_RESPONSE_SERVER_EXCEPTION;
+            reply.reply = frame.payload.method;
+            // owns a copy of the close, so the buffers can go
+            const AmqpRpcError error("Declaring topology", reply);
+
+            if(method_id == AMQP_CHANNEL_CLOSE_METHOD)
+            {
+                amqp_channel_close_ok_t close_ok;
+                check("Closing channel",
+                      amqp_send_method(conn, id, AMQP_CHANNEL_CLOSE_OK_METHOD,
+                                       &close_ok), true);
+            }
+            early_frames_.clear();
+            if(!handed_out)
+                conn.release_buffers();
+            throw error;
+        }
+
+        if(method && frame.channel == id && method_id == replies.front().id)
+        {
+            complete(replies.front(), frame);
+            replies.pop_front();
+            if(early_frames_.empty() && !handed_out)
+                conn.release_buffers();
+        }
+        else if(unhandled_)
+        {
+            handed_out = true;
+            unhandled_(frame);
+        }
+        else
+            early_frames_.push_back(frame);
+    }
+}
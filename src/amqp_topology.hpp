@@ -0,0 +1,173 @@
+#ifndef AMQP_TOPOLOGY_HPP
+#define AMQP_TOPOLOGY_HPP
+
+#include <string>
+#include <vector>
+#include "amqp_channel.hpp"
+
+class FrameEncoder;
+
+struct ExchangeData
+{
+    ExchangeData(amqp_bytes_t name, amqp_bytes_t exchange_type):
+        exchange(name),
+        type(exchange_type),
+        passive(0),
+        durable(0),
+        auto_delete(0),
+        internal(0),
+        arguments(amqp_empty_table)
+    {}
+
+    amqp_bytes_t exchange;
+    amqp_bytes_t type;
+    amqp_boolean_t passive;
+    amqp_boolean_t durable;
+    amqp_boolean_t auto_delete;
+    amqp_boolean_t internal;
+    amqp_table_t arguments;
+};
+
+struct BindData
+{
+    BindData(amqp_bytes_t q, amqp_bytes_t ex, amqp_bytes_t rk):
+        queue(q),
+        exchange(ex),
+        routing_key(rk),
+        arguments(amqp_empty_table)
+    {}
+
+    amqp_bytes_t queue;
+    amqp_bytes_t exchange;
+    amqp_bytes_t routing_key;
+    amqp_table_t arguments;
+};
+
+// The exchanges, queues, bindings, QoS and consumers of a channel, kept
+// as owned copies so the whole setup can be applied again after a
+// reconnect. apply() encodes every declaration into one write, with nowait
+// set wherever the reply carries nothing needed, and ends with a passive
+// declare of amq.direct whose reply proves that everything before it
+// succeeded; a cold start costs one round trip instead of one per
+// declaration.
+//
+// Replies are still awaited for QoS, server-named queues (empty name) and
+// consumers without a tag, since only the reply says which name the broker
+// chose. An empty queue name in a binding or consumer means the queue
+// declared last, as in the protocol, so server-named queues work on every
+// apply().
+class Topology
+{
+public:
+    Topology();
+
+    void exchange(const ExchangeData& data);
+    void queue(const QueueData& data);
+    void bind(const BindData& data);
+    void qos(const QosData& data);
+    void consume(const ConsumeData& data);
+
+    size_t size() const
+    {
+        return declarations_.size();
+    }
+
+    // Throws AmqpRpcError if the broker rejects a declaration; the broker
+    // has closed the channel then.
+    void apply(AmqpChannel& channel);
+
+    // Queue names and consumer tags in declaration order, as of the last
+    // apply().
+    const std::vector<std::string>& queue_names() const
+    {
+        return queue_names_;
+    }
+
+    const std::vector<std::string>& consumer_tags() const
+    {
+        return consumer_tags_;
+    }
+
+    // Receives frames read while waiting that are not replies, e.g. the
+    // first deliveries to new consumers. Once the first one is handed
+    // over, apply() no longer releases the connection's buffers, so the
+    // frames stay valid until the handler or the caller releases them.
+    void unhandled_frame_handler(const FrameHandler& handler)
+    {
+        unhandled_ = handler;
+    }
+
+    // Without a handler, the frames that were not replies are kept here in
+    // arrival order. apply() then leaves the connection's buffers alone
+    // once the first one arrived, so they stay valid until the caller has
+    // processed them and called AmqpConnection::release_buffers().
+    const std::vector<amqp_frame_t>& early_frames() const
+    {
+        return early_frames_;
+    }
+
+private:
+    enum Kind
+    {
+        exchange_declare,
+        queue_declare,
+        queue_bind,
+        basic_qos,
+        basic_consume
+    };
+
+    struct Declaration
+    {
+        explicit Declaration(Kind k):
+            kind(k),
+            passive(),
+            durable(),
+            exclusive(),
+            auto_delete(),
+            internal(),
+            no_local(),
+            no_ack(),
+            global(),
+            prefetch_size(),
+            prefetch_count(),
+            result_index()
+        {}
+
+        Kind kind;
+        AmqpBytes name; // exchange or queue
+        AmqpBytes target; // exchange type, bound exchange or consumer tag
+        AmqpBytes routing_key;
+        amqp_boolean_t passive;
+        amqp_boolean_t durable;
+        amqp_boolean_t exclusive;
+        amqp_boolean_t auto_delete;
+        amqp_boolean_t internal;
+        amqp_boolean_t no_local;
+        amqp_boolean_t no_ack;
+        amqp_boolean_t global;
+        uint32_t prefetch_size;
+        uint16_t prefetch_count;
+        AmqpTable arguments;
+        size_t result_index; // into queue_names_ or consumer_tags_
+    };
+
+    struct Reply
+    {
+        amqp_method_number_t id;
+        const Declaration* declaration; // null for the final check
+    };
+
+    Reply encode(Declaration& declaration, amqp_channel_t channel,
+                 FrameEncoder& encoder);
+    void complete(const Reply& reply, const amqp_frame_t& frame);
+
+    std::vector<Declaration> declarations_;
+    size_t queues_;
+    size_t consumers_;
+    std::vector<std::string> queue_names_;
+    std::vector<std::string> consumer_tags_;
+    FrameHandler unhandled_;
+    std::vector<amqp_frame_t> early_frames_;
+};
+
+#endif // AMQP_TOPOLOGY_HPP
@@ -0,0 +1,26 @@
+#ifndef AMQP_TRANSPORT_HPP
+#define AMQP_TRANSPORT_HPP
+
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+
+// Byte stream of a connection as seen by FrameReader and FrameEncoder.
+// Without one installed (AmqpConnection::transport()) both use the
+// connection's socket directly; librabbitmq itself always does.
+class Transport: boost::noncopyable
+{
+public:
+    // Waits up to timeout_ms (-1 for no limit) for data and copies at most
+    // size bytes of it to out. Returns the number of bytes, 0 on timeout,
+    // or a negative librabbitmq-style error code.
+    virtual int receive(char* out, size_t size, int timeout_ms) = 0;
+
+    // Writes all of data; returns 0 or a negative librabbitmq-style error
+    // code, after which the connection is unusable.
+    virtual int send(const char* data, size_t size) = 0;
+
+    virtual ~Transport()
+    {}
+};
+
+#endif // AMQP_TRANSPORT_HPP
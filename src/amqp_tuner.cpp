@@ -0,0 +1,97 @@
+#include "amqp_tuner.hpp"
+#include <algorithm>
+#include <limits>
+#include <boost/chrono.hpp>
+#include "amqp_confirm.hpp"
+#include "amqp_publish_batch.hpp"
+
+namespace
+{
+    typedef boost::chrono::steady_clock Clock;
+
+    const char probe_routing_key[] = "amqcpp.tuner.unroutable";
+}
+
+ConnectionTuner::ConnectionTuner(const ConnectionOptions& base,
+                                 size_t probe_size, size_t probe_messages,
+                                 unsigned rounds):
+    base_(base),
+    probe_size_(probe_size),
+    probe_messages_(probe_messages),
+    rounds_(rounds)
+{}
+
+void ConnectionTuner::add_candidate(int frame_max, int socket_buffer)
+{
+    candidates_.push_back(Candidate(frame_max, socket_buffer));
+}
+
+ConnectionOptions ConnectionTuner::options(const Candidate& candidate) const
+{
+    ConnectionOptions result = base_;
+    result.frame_max = candidate.frame_max;
+    result.send_buffer = candidate.socket_buffer;
+    result.receive_buffer = candidate.socket_buffer;
+    return result;
+}
+
+ConnectionTuner::Result
+ConnectionTuner::measure(const Candidate& candidate) const
+{
+    AmqpConnection conn(options(candidate));
+    AmqpChannel channel(conn);
+    ConfirmTracker confirms(channel, probe_messages_);
+
+    PublishData data(amqp_cstring_bytes(probe_routing_key),
+                     std::string(probe_size_, 'x'));
+    double best = std::numeric_limits<double>::max();
+
+    for(unsigned round = 0; round < rounds_; ++round)
+    {
+        const Clock::time_point start = Clock::now();
+        {
+            PublishBatch batch(channel);
+            for(size_t i = 0; i < probe_messages_; ++i)
+            {
+                batch.add(data);
+                confirms.track();
+            }
+            batch.flush();
+        }
+        confirms.wait_all();
+
+        const double seconds = boost::chrono::duration<double>(
+                    Clock::now() - start).count();
+        best = std::min(best, seconds);
+    }
+    return Result(candidate, conn.frame_max(), best);
+}
+
+ConnectionOptions ConnectionTuner::run()
+{
+    if(candidates_.empty())
+    {
+        const int frame_sizes[] = { 1 << 14, 1 << 17, 1 << 20 };
+        const int buffer_sizes[] = { 0, 1 << 20, 1 << 22 };
+        for(size_t f = 0; f < 3; ++f)
+        {
+            for(size_t b = 0; b < 3; ++b)
+                add_candidate(frame_sizes[f], buffer_sizes[b]);
+        }
+    }
+
+    results_.clear();
+    size_t fastest = 0;
+    for(size_t i = 0; i < candidates_.size(); ++i)
+    {
+        results_.push_back(measure(candidates_[i]));
+        if(results_[i].seconds < results_[fastest].seconds)
+            fastest = i;
+    }
+
+    const Result& winner = results_[fastest];
+    ConnectionOptions result = options(winner.candidate);
+    // a larger request than the broker granted gains nothing
+    result.frame_max = winner.frame_max;
+    return result;
+}
@@ -0,0 +1,71 @@
+#ifndef AMQP_TUNER_HPP
+#define AMQP_TUNER_HPP
+
+#include <vector>
+#include "amqp_connection.hpp"
+
+// Picks frame_max and socket buffer sizes for a link by measurement. For
+// every candidate a probe connection is opened with those values, and
+// probe_messages messages of probe_size bytes are published in one batch
+// to an unroutable routing key on the default exchange, so the broker
+// drops them; the time until all are confirmed is the candidate's score.
+// Each candidate is measured rounds times and its best time counts.
+//
+//     AmqpConnection conn(ConnectionTuner(options).run());
+class ConnectionTuner: boost::noncopyable
+{
+public:
+    struct Candidate
+    {
+        Candidate(int f, int buffer):
+            frame_max(f),
+            socket_buffer(buffer)
+        {}
+
+        int frame_max;
+        int socket_buffer; // SO_SNDBUF and SO_RCVBUF, 0 for the default
+    };
+
+    struct Result
+    {
+        Result(const Candidate& c, int negotiated, double s):
+            candidate(c),
+            frame_max(negotiated),
+            seconds(s)
+        {}
+
+        Candidate candidate;
+        int frame_max; // as negotiated with the broker
+        double seconds;
+    };
+
+    explicit ConnectionTuner(const ConnectionOptions& base,
+                             size_t probe_size = 1 << 16,
+                             size_t probe_messages = 128,
+                             unsigned rounds = 2);
+
+    // Without candidates, run() tries frame_max 16 KiB, 128 KiB and 1 MiB
+    // with default, 1 MiB and 4 MiB socket buffers.
+    void add_candidate(int frame_max, int socket_buffer = 0);
+
+    // Returns the base options with the fastest candidate's values.
+    ConnectionOptions run();
+
+    const std::vector<Result>& results() const
+    {
+        return results_;
+    }
+
+private:
+    ConnectionOptions options(const Candidate& candidate) const;
+    Result measure(const Candidate& candidate) const;
+
+    const ConnectionOptions base_;
+    const size_t probe_size_;
+    const size_t probe_messages_;
+    const unsigned rounds_;
+    std::vector<Candidate> candidates_;
+    std::vector<Result> results_;
+};
+
+#endif // AMQP_TUNER_HPP
@@ -1,5 +1,110 @@
 #include "amqp_types.hpp"
 #include "amqp_private.hpp"
+#include <new>
+#include <boost/atomic.hpp>
+
+namespace
+{
+    // precedes the data of a shared AmqpBytes buffer
+    struct SharedHeader
+    {
+        boost::atomic<long> refs;
+        long padding;
+    };
+
+    inline SharedHeader* shared_header(const amqp_bytes_t& data)
+    {
+        return reinterpret_cast<SharedHeader*>(data.bytes) - 1;
+    }
+}
+
+void AmqpBytes::init(const amqp_bytes_t& value)
+{
+    if(value.len == 0)
+        return;
+
+    if(value.len <= inline_capacity)
+    {
+        memcpy(inline_, value.bytes, value.len);
+        data_.bytes = inline_;
+        data_.len = value.len;
+    }
+    else
+    {
+        data_ = amqp_bytes_malloc_dup(value);
+        if(data_.bytes == 0)
+            throw std::bad_alloc();
+        storage_ = heap_storage;
+    }
+}
+
+void AmqpBytes::init_shared(const amqp_bytes_t& value)
+{
+    void* memory = ::operator new(sizeof(SharedHeader) + value.len);
+    SharedHeader* header = new(memory) SharedHeader;
+    header->refs.store(1, boost::memory_order_relaxed);
+
+    data_.bytes = header + 1;
+    data_.len = value.len;
+    memcpy(data_.bytes, value.bytes, value.len);
+    storage_ = shared_storage;
+}
+
+void AmqpBytes::copy(const AmqpBytes& other)
+{
+    if(other.storage_ == shared_storage)
+    {
+        shared_header(other.data_)->refs.fetch_add(1,
+                                                  boost::memory_order_relaxed);
+        data_ = other.data_;
+        storage_ = shared_storage;
+    }
+    else
+        init(other.data_);
+}
+
+void AmqpBytes::take(AmqpBytes& other) BOOST_NOEXCEPT
+{
+    if(other.storage_ == inline_storage && other.data_.len > 0)
+    {
+        memcpy(inline_, other.inline_, other.data_.len);
+        data_.bytes = inline_;
+        data_.len = other.data_.len;
+    }
+    else
+        data_ = other.data_;
+
+    storage_ = other.storage_;
+    other.data_ = amqp_bytes_t();
+    other.storage_ = inline_storage;
+}
+
+void AmqpBytes::release() BOOST_NOEXCEPT
+{
+    switch(storage_)
+    {
+    case inline_storage:
+        break;
+
+    case heap_storage:
+        amqp_bytes_free(data_);
+        break;
+
+    case shared_storage:
+        {
+            SharedHeader* header = shared_header(data_);
+            if(header->refs.fetch_sub(1, boost::memory_order_acq_rel) == 1)
+            {
+                header->~SharedHeader();
+                ::operator delete(header);
+            }
+        }
+        break;
+    }
+
+    data_ = amqp_bytes_t();
+    storage_ = inline_storage;
+}
 
 AmqpTableEntry::operator amqp_table_entry_t()
 {
@@ -60,6 +165,14 @@ amqp_table_t AmqpTable::data()
     return table;
 }
 
+AmqpTable AmqpTable::fork() const
+{
+    AmqpTable result;
+    result.data_->base = data_;
+    result.entries_ = entries_;
+    return result;
+}
+
 AmqpTable::~AmqpTable()
 {}
 
@@ -2,41 +2,92 @@
 #define AMQP_TYPES_HPP
 
 #include <vector>
+#include <boost/config.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/variant/variant.hpp>
 #include <boost/variant/get.hpp>
 #include <amqp.h>
 #include "util.hpp"
 
+// Owned copy of an AMQP byte string. Values up to inline_capacity bytes
+// (routing keys, correlation ids, content types) are stored in the object
+// itself; longer ones are malloc'ed. make_shared() opts into a reference
+// counted buffer, so copies of a large body share one allocation.
 class AmqpBytes
 {
 public:
-    AmqpBytes(): data_()
+    static const size_t inline_capacity = 32;
+
+    AmqpBytes():
+        data_(),
+        storage_(inline_storage)
     {}
 
     template<typename T> AmqpBytes(const T& value):
-        data_(to_amqp_bytes(value, true))
-    {}
+        data_(),
+        storage_(inline_storage)
+    {
+        init(to_amqp_bytes(value));
+    }
 
     AmqpBytes(const AmqpBytes& other):
-        data_(amqp_bytes_malloc_dup(other.data_))
-    {}
+        data_(),
+        storage_(inline_storage)
+    {
+        copy(other);
+    }
+
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+    // noexcept, so that containers move rather than copy on growth
+    AmqpBytes(AmqpBytes&& other) BOOST_NOEXCEPT:
+        data_(),
+        storage_(inline_storage)
+    {
+        take(other);
+    }
+
+    AmqpBytes& operator = (AmqpBytes&& other) BOOST_NOEXCEPT
+    {
+        if(&other != this)
+        {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+#endif
+
+    template<typename T> static AmqpBytes make_shared(const T& value)
+    {
+        AmqpBytes result;
+        result.init_shared(to_amqp_bytes(value));
+        return result;
+    }
 
     template<typename T> AmqpBytes& operator = (const T& value)
     {
-        if(data_.len > 0)
-            amqp_bytes_free(data_);
-        data_ = to_amqp_bytes(value, true);
+        AmqpBytes bytes(value);
+        release();
+        take(bytes);
         return *this;
     }
 
     AmqpBytes& operator = (const AmqpBytes& other)
     {
         if(&other != this)
-            *this = other.data_;
+        {
+            AmqpBytes bytes(other);
+            release();
+            take(bytes);
+        }
         return *this;
     }
 
+    bool shared() const
+    {
+        return storage_ == shared_storage;
+    }
+
     const amqp_bytes_t& data() const
     {
         return data_;
@@ -49,12 +100,26 @@ public:
 
     ~AmqpBytes()
     {
-        if(data_.len > 0)
-            amqp_bytes_free(data_);
+        release();
     }
 
 private:
+    enum Storage
+    {
+        inline_storage,
+        heap_storage,
+        shared_storage
+    };
+
+    void init(const amqp_bytes_t& value);
+    void init_shared(const amqp_bytes_t& value);
+    void copy(const AmqpBytes& other);
+    void take(AmqpBytes& other) BOOST_NOEXCEPT;
+    void release() BOOST_NOEXCEPT;
+
     amqp_bytes_t data_;
+    Storage storage_;
+    char inline_[inline_capacity];
 };
 
 class AmqpFieldValue;
@@ -89,6 +154,11 @@ public:
     void add(const AmqpBytes& key, const AmqpFieldValue& value);
     amqp_table_t data();
 
+    // Copies share their storage, so add() on a copy changes what other
+    // threads holding one read. A fork has the same entries, but adds to
+    // storage of its own.
+    AmqpTable fork() const;
+
     operator amqp_table_t()
     {
         return data();
@@ -200,6 +270,12 @@ public:
         return headers_;
     }
 
+    void headers(const AmqpTable& value)
+    {
+        headers_ = value;
+        flags_ |= AMQP_BASIC_HEADERS_FLAG;
+    }
+
     void add_header(const AmqpBytes& key, const AmqpFieldValue& value)
     {
         headers_.add(key, value);
@@ -0,0 +1,276 @@
+#include "amqp_uring.hpp"
+
+#ifdef AMQP_WITH_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    // liburing returns -errno instead of setting errno
+    inline void check_uring(const char* context, int rc)
+    {
+        if(rc < 0)
+        {
+            errno = -rc;
+            check_os(context, -1);
+        }
+    }
+
+    inline unsigned queue_entries(size_t links)
+    {
+        unsigned entries = 8;
+        while(entries < 2 * links)
+            entries *= 2;
+        return entries;
+    }
+}
+
+UringTransport::UringTransport(AmqpConnection& conn, unsigned buffer_count,
+                               size_t buffer_size, size_t send_size):
+    fd_(conn.sockfd()),
+    buffer_count_(buffer_count),
+    buffer_size_(buffer_size),
+    buffers_(),
+    receive_buffers_(buffer_count * buffer_size),
+    send_buffer_(std::max(send_size, buffer_size)),
+    armed_(false),
+    receive_error_(),
+    pending_sends_()
+{
+    if(buffer_count_ == 0 || (buffer_count_ & (buffer_count_ - 1)) != 0)
+        throw std::logic_error("buffer_count must be a power of two");
+
+    const size_t links = (send_buffer_.size() + buffer_size_ - 1) /
+            buffer_size_;
+    check_uring("Creating io_uring",
+                io_uring_queue_init(queue_entries(links), &ring_, 0));
+
+    try
+    {
+        iovec registered;
+        registered.iov_base = &send_buffer_[0];
+        registered.iov_len = send_buffer_.size();
+        check_uring("Registering send buffer",
+                    io_uring_register_buffers(&ring_, &registered, 1));
+
+        int rc = 0;
+        buffers_ = io_uring_setup_buf_ring(&ring_, buffer_count_,
+                                           buffer_group, 0, &rc);
+        check_uring("Registering receive buffers", buffers_ != 0 ? 0 : rc);
+
+        for(unsigned i = 0; i < buffer_count_; ++i)
+            recycle(i);
+    }
+    catch(...)
+    {
+        if(buffers_ != 0)
+            io_uring_free_buf_ring(&ring_, buffers_, buffer_count_,
+                                   buffer_group);
+        io_uring_queue_exit(&ring_);
+        throw;
+    }
+}
+
+UringTransport::~UringTransport()
+{
+    io_uring_free_buf_ring(&ring_, buffers_, buffer_count_, buffer_group);
+    io_uring_queue_exit(&ring_);
+}
+
+void UringTransport::recycle(unsigned short id)
+{
+    io_uring_buf_ring_add(buffers_, &receive_buffers_[id * buffer_size_],
+                          buffer_size_, id,
+                          io_uring_buf_ring_mask(buffer_count_), 0);
+    io_uring_buf_ring_advance(buffers_, 1);
+}
+
+void UringTransport::arm()
+{
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    if(sqe == 0)
+    {
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+    }
+
+    io_uring_prep_recv_multishot(sqe, fd_, 0, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffer_group;
+    io_uring_sqe_set_data64(sqe, recv_tag);
+    io_uring_submit(&ring_);
+    armed_ = true;
+}
+
+void UringTransport::complete(const io_uring_cqe& cqe)
+{
+    if(io_uring_cqe_get_data64(&cqe) != recv_tag)
+    {
+        send_results_[io_uring_cqe_get_data64(&cqe) - 1] = cqe.res;
+        --pending_sends_;
+        return;
+    }
+
+    if((cqe.flags & IORING_CQE_F_MORE) == 0)
+        armed_ = false;
+
+    if(cqe.res > 0)
+    {
+        Chunk chunk;
+        chunk.id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        chunk.offset = 0;
+        chunk.size = cqe.res;
+        received_.push_back(chunk);
+    }
+    else if(cqe.res == 0)
+        receive_error_ = connection_closed_error();
+    else if(cqe.res != -ENOBUFS)
+        receive_error_ = os_error(-cqe.res);
+    // out of buffers: re-armed once some are copied out
+}
+
+int UringTransport::wait(int timeout_ms)
+{
+    io_uring_cqe* cqe = 0;
+    int rc;
+    if(timeout_ms < 0)
+        rc = io_uring_wait_cqe(&ring_, &cqe);
+    else
+    {
+        __kernel_timespec timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+        rc = io_uring_wait_cqe_timeout(&ring_, &cqe, &timeout);
+    }
+
+    if(rc == -ETIME || rc == -EINTR)
+        return 0;
+    if(rc < 0)
+        return os_error(-rc);
+
+    // take everything that completed meanwhile
+    while(cqe != 0)
+    {
+        complete(*cqe);
+        io_uring_cqe_seen(&ring_, cqe);
+        if(io_uring_peek_cqe(&ring_, &cqe) != 0)
+            cqe = 0;
+    }
+    return 1;
+}
+
+size_t UringTransport::copy_received(char* out, size_t size)
+{
+    size_t copied = 0;
+    while(copied < size && !received_.empty())
+    {
+        Chunk& chunk = received_.front();
+        const size_t count = std::min(size - copied, chunk.size);
+        memcpy(out + copied,
+               &receive_buffers_[chunk.id * buffer_size_ + chunk.offset],
+               count);
+        copied += count;
+        chunk.offset += count;
+        chunk.size -= count;
+
+        if(chunk.size == 0)
+        {
+            recycle(chunk.id);
+            received_.pop_front();
+        }
+    }
+    return copied;
+}
+
+int UringTransport::receive(char* out, size_t size, int timeout_ms)
+{
+    while(received_.empty() && receive_error_ == 0)
+    {
+        if(!armed_)
+            arm();
+
+        const int rc = wait(timeout_ms);
+        if(rc < 0)
+            return rc;
+        if(rc == 0 && timeout_ms >= 0)
+            return 0;
+    }
+
+    if(received_.empty())
+        return receive_error_;
+    return copy_received(out, size);
+}
+
+int UringTransport::send_chain(const char* data, size_t size,
+                               size_t& written)
+{
+    memcpy(&send_buffer_[0], data, size);
+
+    const size_t links = (size + buffer_size_ - 1) / buffer_size_;
+    send_results_.assign(links, 0);
+    pending_sends_ = links;
+
+    for(size_t i = 0; i < links; ++i)
+    {
+        const size_t offset = i * buffer_size_;
+        const size_t length = std::min(buffer_size_, size - offset);
+
+        // the queue holds two full chains, so there is always room
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+        io_uring_prep_write_fixed(sqe, fd_, &send_buffer_[offset], length,
+                                  0, 0);
+        io_uring_sqe_set_data64(sqe, i + 1);
+        if(i + 1 < links)
+            sqe->flags |= IOSQE_IO_LINK;
+    }
+
+    const int rc = io_uring_submit(&ring_);
+    if(rc < 0)
+        return os_error(-rc);
+
+    while(pending_sends_ > 0)
+    {
+        const int rc = wait(-1);
+        if(rc < 0)
+            return rc;
+    }
+
+    // a short write cancels the rest of the chain
+    written = 0;
+    for(size_t i = 0; i < links; ++i)
+    {
+        const int result = send_results_[i];
+        const size_t length = std::min(buffer_size_, size - i * buffer_size_);
+        if(result > 0)
+            written += result;
+        if(result < 0 && result != -ECANCELED)
+            return os_error(-result);
+        if(result != static_cast<int>(length))
+            break;
+    }
+    return 0;
+}
+
+int UringTransport::send(const char* data, size_t size)
+{
+    while(size > 0)
+    {
+        size_t written = 0;
+        const int rc = send_chain(data,
+                                  std::min(size, send_buffer_.size()),
+                                  written);
+        if(rc < 0)
+            return rc;
+        if(written == 0)
+            return os_error(EIO);
+
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+#endif // AMQP_WITH_IO_URING
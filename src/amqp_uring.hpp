@@ -0,0 +1,80 @@
+#ifndef AMQP_URING_HPP
+#define AMQP_URING_HPP
+
+// io_uring transport; empty unless built with AMQP_WITH_IO_URING defined
+// and linked with liburing (2.4 or later, Linux 6.0 or later).
+#ifdef AMQP_WITH_IO_URING
+
+#include <deque>
+#include <vector>
+#include <liburing.h>
+#include "amqp_connection.hpp"
+
+// Transport over an io_uring of its own. Receiving keeps a multishot
+// recv armed on the socket, which fills a ring of provided buffers
+// registered with the kernel, so a busy connection delivers data without
+// a syscall per read. Sending copies the data into a registered buffer
+// and writes it as a chain of linked fixed-buffer writes, one submission
+// per chain, so a large publish batch costs one syscall however many
+// slices it has.
+//
+// Install it with AmqpConnection::transport() once the connection is set
+// up. From then on the armed recv takes everything the broker sends, so
+// only FrameReader may read the connection: no synchronous RPCs, and no
+// AmqpEventLoop. Writes by librabbitmq (acks, AmqpChannel::publish) still
+// go to the socket directly and must not overlap send(). Only FrameEncoder
+// sends, i.e. PublishBatch and PublishTemplate, go through the transport;
+// ChannelPool writes from many threads and refuses a connection with a
+// transport. Not thread safe.
+class UringTransport: public Transport
+{
+public:
+    // buffer_count must be a power of two; send_size is the registered
+    // send buffer, cut into links of buffer_size bytes.
+    explicit UringTransport(AmqpConnection& conn,
+                            unsigned buffer_count = 64,
+                            size_t buffer_size = 1 << 16,
+                            size_t send_size = 1 << 18);
+
+    virtual int receive(char* out, size_t size, int timeout_ms);
+    virtual int send(const char* data, size_t size);
+
+    virtual ~UringTransport();
+
+private:
+    static const uint64_t recv_tag = 0;
+    static const int buffer_group = 0;
+
+    // received data in a provided buffer not yet copied out
+    struct Chunk
+    {
+        unsigned short id;
+        size_t offset;
+        size_t size;
+    };
+
+    void arm();
+    int wait(int timeout_ms);
+    void complete(const io_uring_cqe& cqe);
+    void recycle(unsigned short id);
+    size_t copy_received(char* out, size_t size);
+    int send_chain(const char* data, size_t size, size_t& written);
+
+    const int fd_;
+    const unsigned buffer_count_;
+    const size_t buffer_size_;
+    io_uring ring_;
+    io_uring_buf_ring* buffers_;
+    std::vector<char> receive_buffers_;
+    std::vector<char> send_buffer_;
+
+    std::deque<Chunk> received_;
+    bool armed_;
+    int receive_error_;
+
+    std::vector<int> send_results_;
+    size_t pending_sends_;
+};
+
+#endif // AMQP_WITH_IO_URING
+#endif // AMQP_URING_HPP
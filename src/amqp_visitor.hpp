@@ -1,13 +1,118 @@
 #ifndef AMQP_VISITOR_HPP
 #define AMQP_VISITOR_HPP
 
+#include <stdexcept>
+#include <vector>
 #include "amqp_types.hpp"
+#include "amqp_body_pool.hpp"
+#include "amqp_body_sink.hpp"
 
 typedef std::pair<amqp_bytes_t, bool> BodyFragment;
+typedef std::pair<const amqp_basic_properties_t*, uint64_t> ContentHeader;
+
+// Read-only scatter view of a message body. The spans point into the
+// connection's frame buffers and stay valid until
+// AmqpConnection::release_buffers() is called.
+class BodyView
+{
+public:
+    typedef std::vector<amqp_bytes_t>::const_iterator const_iterator;
+
+    BodyView(): size_()
+    {}
+
+    const_iterator begin() const
+    {
+        return fragments_.begin();
+    }
+
+    const_iterator end() const
+    {
+        return fragments_.end();
+    }
+
+    size_t fragment_count() const
+    {
+        return fragments_.size();
+    }
+
+    const amqp_bytes_t& fragment(size_t i) const
+    {
+        return fragments_[i];
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool contiguous() const
+    {
+        return fragments_.size() <= 1;
+    }
+
+    void copy_to(std::string& out) const
+    {
+        out.reserve(out.size() + size_);
+        for(const_iterator it = begin(); it != end(); ++it)
+            out.append(static_cast<const char*>(it->bytes), it->len);
+    }
+
+    void append(const amqp_bytes_t& fragment)
+    {
+        fragments_.push_back(fragment);
+        size_ += fragment.len;
+    }
+
+    void clear()
+    {
+        fragments_.clear();
+        size_ = 0;
+    }
+
+private:
+    std::vector<amqp_bytes_t> fragments_;
+    size_t size_;
+};
 
 class AmqpVisitor: public boost::static_visitor<bool>
 {
 public:
+    enum BodyMode
+    {
+        copy_body,
+        reference_body,
+        pooled_body,
+        streamed_body
+    };
+
+    // For copy_body and reference_body; pooled_body and streamed_body take
+    // the pool and sink constructors.
+    explicit AmqpVisitor(BodyMode mode = copy_body):
+        mode_(unbacked_mode(mode)),
+        pool_(),
+        sink_()
+    {}
+
+    explicit AmqpVisitor(BodyBufferPool& pool):
+        mode_(pooled_body),
+        pool_(&pool),
+        sink_()
+    {}
+
+    // Streams each body through the sink as its frames arrive; the body
+    // is not kept, so the message is complete once the sink's end() ran.
+    explicit AmqpVisitor(BodySink& sink):
+        mode_(streamed_body),
+        pool_(),
+        sink_(&sink)
+    {}
+
+    BodyMode mode() const
+    {
+        return mode_;
+    }
+
     uint64_t delivery_tag() const
     {
         return delivery_tag_;
@@ -18,14 +123,34 @@ public:
         return body_;
     }
 
+    // Only filled in reference_body mode.
+    const BodyView& body_view() const
+    {
+        return body_view_;
+    }
+
+    // Only filled in pooled_body mode. Keep a copy of the pointer to hold
+    // the body past reset(); the buffer is recycled once it is dropped.
+    const BodyBufferPtr& body_buffer() const
+    {
+        return body_buffer_;
+    }
+
     const amqp_basic_properties_t* properties() const
     {
         return properties_;
     }
 
+    uint64_t body_size() const
+    {
+        return body_size_;
+    }
+
     void reset()
     {
         body_.clear();
+        body_view_.clear();
+        body_buffer_.reset();
     }
 
     bool operator()(const amqp_basic_deliver_t* deliver)
@@ -34,16 +159,49 @@ public:
         return false;
     }
 
-    bool operator()(const amqp_basic_properties_t* props)
+    bool operator()(const ContentHeader& header)
     {
-        properties_ = props;
-        return false;
+        properties_ = header.first;
+        body_size_ = header.second;
+
+        if(mode_ == pooled_body)
+            body_buffer_ = pool_->acquire(body_size_);
+        else if(mode_ == copy_body)
+            body_.reserve(body_size_);
+        else if(mode_ == streamed_body)
+        {
+            sink_->begin(delivery_tag_, properties_, body_size_);
+            if(body_size_ == 0)
+                sink_->end();
+        }
+
+        // no body frames follow an empty body
+        return body_size_ == 0;
     }
 
     bool operator()(const BodyFragment& body_fragment)
     {
         const amqp_bytes_t& fragment = body_fragment.first;
-        body_.append(static_cast<char*>(fragment.bytes), fragment.len);
+        switch(mode_)
+        {
+        case copy_body:
+            body_.append(static_cast<char*>(fragment.bytes), fragment.len);
+            break;
+
+        case reference_body:
+            body_view_.append(fragment);
+            break;
+
+        case pooled_body:
+            body_buffer_->append(fragment);
+            break;
+
+        case streamed_body:
+            sink_->write(fragment);
+            if(body_fragment.second)
+                sink_->end();
+            break;
+        }
         return body_fragment.second;
     }
 
@@ -53,9 +211,24 @@ public:
     }
 
 private:
+    static BodyMode unbacked_mode(BodyMode mode)
+    {
+        if(mode == pooled_body)
+            throw std::logic_error("AmqpVisitor: pooled_body needs a pool");
+        if(mode == streamed_body)
+            throw std::logic_error("AmqpVisitor: streamed_body needs a sink");
+        return mode;
+    }
+
+    const BodyMode mode_;
+    BodyBufferPool* const pool_;
+    BodySink* const sink_;
     uint64_t delivery_tag_;
     const amqp_basic_properties_t* properties_;
+    uint64_t body_size_;
     std::string body_;
+    BodyView body_view_;
+    BodyBufferPtr body_buffer_;
 };
 
 #endif // AMQP_VISITOR_HPP
@@ -0,0 +1,150 @@
+#ifndef AMQP_WORKER_POOL_HPP
+#define AMQP_WORKER_POOL_HPP
+
+#include <deque>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// Fixed set of threads running a handler over posted tasks. Tasks are
+// spread round robin over per-worker queues; a worker takes from the front
+// of its own queue and, when that is empty, steals from the back of the
+// others, so one slow handler does not hold up tasks queued behind it.
+//
+// Each queue has its own lock, so posting and taking contend only on the
+// queue involved. The shared lock is taken only by a worker that found
+// every queue empty and goes to sleep, and by post() when some worker is
+// asleep.
+template<typename T>
+class WorkStealingPool: boost::noncopyable
+{
+public:
+    typedef boost::function<void (T)> Handler;
+
+    WorkStealingPool(size_t threads, const Handler& handler):
+        handler_(handler),
+        next_(0),
+        pending_(0),
+        sleeping_(0),
+        stopped_(false)
+    {
+        for(size_t i = 0; i < threads; ++i)
+            workers_.push_back(new Worker);
+
+        for(size_t i = 0; i < threads; ++i)
+            threads_.create_thread(boost::bind(&WorkStealingPool::run,
+                                               this, i));
+    }
+
+    void post(const T& task)
+    {
+        Worker& worker = workers_[next_++ % workers_.size()];
+        {
+            // pairs with the sleeping_ increment before the pending_ check
+            // in run(): either the worker sees the task or this sees the
+            // sleeper
+            boost::mutex::scoped_lock lock(worker.mutex);
+            pending_.fetch_add(1);
+            worker.tasks.push_back(task);
+        }
+
+        if(sleeping_.load() > 0)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            ready_.notify_one();
+        }
+    }
+
+    size_t size() const
+    {
+        return workers_.size();
+    }
+
+    // Runs the tasks already posted, then joins the threads.
+    ~WorkStealingPool()
+    {
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            stopped_ = true;
+            ready_.notify_all();
+        }
+        threads_.join_all();
+    }
+
+private:
+    struct Worker
+    {
+        boost::mutex mutex;
+        std::deque<T> tasks;
+    };
+
+    bool take(size_t self, T& task)
+    {
+        const size_t count = workers_.size();
+        for(size_t i = 0; i < count; ++i)
+        {
+            Worker& worker = workers_[(self + i) % count];
+            boost::mutex::scoped_lock lock(worker.mutex);
+            if(worker.tasks.empty())
+                continue;
+
+            if(i == 0)
+            {
+                task = worker.tasks.front();
+                worker.tasks.pop_front();
+            }
+            else
+            {
+                task = worker.tasks.back();
+                worker.tasks.pop_back();
+            }
+            pending_.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t self)
+    {
+        while(true)
+        {
+            T task;
+            if(take(self, task))
+            {
+                handler_(task);
+                continue;
+            }
+
+            boost::mutex::scoped_lock lock(mutex_);
+            sleeping_.fetch_add(1);
+            while(pending_.load() == 0 && !stopped_)
+                ready_.wait(lock);
+            sleeping_.fetch_sub(1);
+
+            if(pending_.load() == 0)
+                return;
+        }
+    }
+
+    const Handler handler_;
+    boost::ptr_vector<Worker> workers_;
+    boost::thread_group threads_;
+    boost::atomic<size_t> next_;
+
+    // tasks queued but not yet taken; never fewer than the queues hold,
+    // since a task is counted under its queue's lock before it is queued
+    // and uncounted under that lock once taken
+    boost::atomic<size_t> pending_;
+    boost::atomic<size_t> sleeping_;
+
+    boost::mutex mutex_;
+    boost::condition_variable ready_;
+    bool stopped_;
+};
+
+#endif // AMQP_WORKER_POOL_HPP
@@ -1,10 +1,17 @@
 #include "error.hpp"
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <boost/scope_exit.hpp>
 
 namespace
 {
+    // amqp_private.h of librabbitmq 0.3, which is not installed
+    const int error_category_os = 1 << 8;
+    const int error_bad_amqp_data = 2;
+    const int error_connection_closed = 7;
+
     template<typename T> const char* entity_name();
 
     template<>
@@ -97,6 +104,28 @@ namespace
     {
         return context + ": " + error_message(reply);
     }
+
+    template<typename T> struct OwnedClose
+    {
+        explicit OwnedClose(const void* decoded):
+            method(*static_cast<const T*>(decoded)),
+            text(static_cast<const char*>(method.reply_text.bytes),
+                 method.reply_text.len)
+        {
+            method.reply_text.bytes = const_cast<char*>(text.data());
+        }
+
+        T method;
+        const std::string text;
+    };
+
+    template<typename T> void* own_close(const void* decoded,
+                                        boost::shared_ptr<void>& owner)
+    {
+        boost::shared_ptr<OwnedClose<T> > close(new OwnedClose<T>(decoded));
+        owner = close;
+        return &close->method;
+    }
 }
 
 void check(const char* context, int rc, bool nothrow)
@@ -119,6 +148,40 @@ void check(const char* context, int rc, bool nothrow)
     }
 }
 
+void check_os(const char* context, int rc, bool nothrow)
+{
+    if(rc < 0)
+    {
+        const std::string message =
+                std::string(context) + ": " + strerror(errno);
+
+        if(nothrow)
+            std::cerr << message << std::endl;
+        else
+            throw std::runtime_error(message);
+    }
+}
+
+int os_error(int error)
+{
+    return -(error | error_category_os);
+}
+
+int socket_error()
+{
+    return os_error(errno);
+}
+
+int connection_closed_error()
+{
+    return -error_connection_closed;
+}
+
+int bad_data_error()
+{
+    return -error_bad_amqp_data;
+}
+
 void check_rpc(const char* context, const amqp_rpc_reply_t& reply,
                bool nothrow)
 {
@@ -135,4 +198,25 @@ AmqpRpcError::AmqpRpcError(const std::string& context,
                            const amqp_rpc_reply_t& reply):
     runtime_error(error_message(context, reply)),
     reply_(reply)
-{}
+{
+    // the decoded method lives in the connection's buffers
+    if(reply.reply_type != AMQP_RESPONSE_SERVER_EXCEPTION)
+        return;
+
+    const void* decoded = reply.reply.decoded;
+    switch(reply.reply.id)
+    {
+    case AMQP_CONNECTION_CLOSE_METHOD:
+        reply_.reply.decoded =
+                own_close<amqp_connection_close_t>(decoded, close_);
+        break;
+
+    case AMQP_CHANNEL_CLOSE_METHOD:
+        reply_.reply.decoded = own_close<amqp_channel_close_t>(decoded, close_);
+        break;
+
+    default:
+        reply_.reply.decoded = 0;
+        break;
+    }
+}
@@ -2,6 +2,7 @@
 #define ERROR_HPP
 
 #include <stdexcept>
+#include <boost/shared_ptr.hpp>
 #include <amqp.h>
 
 class AmqpRpcError: public std::runtime_error
@@ -9,6 +10,12 @@ class AmqpRpcError: public std::runtime_error
 public:
     AmqpRpcError(const std::string& context,  const amqp_rpc_reply_t& reply);
 
+    ~AmqpRpcError() throw()
+    {}
+
+    // A channel.close or connection.close in the reply is a copy, valid
+    // after the connection's buffers are released; other methods are not
+    // kept and their decoded pointer is null.
     const amqp_rpc_reply_t& reply() const
     {
         return reply_;
@@ -16,11 +23,21 @@ public:
 
 private:
     amqp_rpc_reply_t reply_;
+    boost::shared_ptr<void> close_;
 };
 
 void check(const char* context, int rc, bool nothrow = false);
 void check_rpc(const char* context, const amqp_rpc_reply_t& reply,
                bool nothrow = false);
+void check_os(const char* context, int rc, bool nothrow = false);
+
+// librabbitmq 0.3 error codes, for paths that bypass its socket calls:
+// an OS failure is -(errno | ERROR_CATEGORY_OS), a closed peer
+// -ERROR_CONNECTION_CLOSED and malformed input -ERROR_BAD_AMQP_DATA.
+int os_error(int error);
+int socket_error();
+int connection_closed_error();
+int bad_data_error();
 
 
 #endif // ERROR_HPP
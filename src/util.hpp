@@ -53,6 +53,31 @@ inline std::string from_amqp_bytes<std::string>(amqp_bytes_t src)
     return std::string(static_cast<char*>(src.bytes), src.len);
 }
 
+// big-endian (network order) writers for hand-encoded frames
+
+inline void put_u8(char* out, uint8_t value)
+{
+    out[0] = static_cast<char>(value);
+}
+
+inline void put_u16(char* out, uint16_t value)
+{
+    put_u8(out, value >> 8);
+    put_u8(out + 1, value & 0xFF);
+}
+
+inline void put_u32(char* out, uint32_t value)
+{
+    put_u16(out, value >> 16);
+    put_u16(out + 2, value & 0xFFFF);
+}
+
+inline void put_u64(char* out, uint64_t value)
+{
+    put_u32(out, static_cast<uint32_t>(value >> 32));
+    put_u32(out + 4, static_cast<uint32_t>(value & 0xFFFFFFFF));
+}
+
 template<typename T> amqp_field_value_t to_field_value(T);
 
 template<> inline
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <amqp_ack.hpp>
+#include "fake_broker.hpp"
+
+// Checks what AckAccumulator puts on the wire when acks interleave with
+// rejects and nacks; the fake broker fails any method that names a tag it
+// no longer holds.
+
+namespace
+{
+    int failures = 0;
+
+    enum Op
+    {
+        ack,
+        nack,
+        reject,
+        defer_reject
+    };
+
+    struct Step
+    {
+        Op op;
+        uint64_t tag;
+    };
+
+    void run(const char* name, const Step* steps, size_t count,
+             const char* const* expected, size_t expected_count)
+    {
+        FakeBroker broker(0, count);
+        {
+            AmqpConnection conn("127.0.0.1", broker.port());
+            AmqpChannel channel(conn);
+            AckAccumulator acks(channel, 1024);
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                switch(steps[i].op)
+                {
+                case ack:
+                    acks.complete(steps[i].tag);
+                    break;
+
+                case nack:
+                    acks.nack(steps[i].tag);
+                    break;
+
+                case reject:
+                    acks.reject(steps[i].tag);
+                    break;
+
+                case defer_reject:
+                    acks.defer_reject(steps[i].tag, false);
+                    break;
+                }
+            }
+            acks.flush();
+        }
+        broker.join();
+
+        const std::vector<std::string> settlements = broker.settlements();
+        const std::vector<std::string> wanted(expected,
+                                              expected + expected_count);
+        const std::vector<std::string> errors = broker.errors();
+
+        if(settlements != wanted || !errors.empty() || broker.unacked() != 0)
+        {
+            ++failures;
+            std::cerr << "FAIL " << name << "\n  sent:";
+            for(size_t i = 0; i < settlements.size(); ++i)
+                std::cerr << " [" << settlements[i] << "]";
+            std::cerr << "\n  expected:";
+            for(size_t i = 0; i < wanted.size(); ++i)
+                std::cerr << " [" << wanted[i] << "]";
+            for(size_t i = 0; i < errors.size(); ++i)
+                std::cerr << "\n  broker: " << errors[i];
+            std::cerr << std::endl;
+        }
+        else
+            std::cout << "ok " << name << std::endl;
+    }
+}
+
+int main()
+{
+    try
+    {
+        const Step interleaved[] = { { ack, 1 }, { reject, 2 }, { ack, 3 } };
+        const char* const interleaved_sent[] = { "ack 1", "reject 2", "ack 3" };
+        run("ack, reject, ack", interleaved, 3, interleaved_sent, 3);
+
+        const Step reversed[] = { { ack, 3 }, { nack, 2 }, { ack, 1 } };
+        const char* const reversed_sent[] = { "nack 2", "ack 1", "ack 3" };
+        run("out of order around a nack", reversed, 3, reversed_sent, 3);
+
+        const Step runs[] = { { ack, 1 }, { ack, 2 }, { ack, 3 },
+                              { reject, 4 }, { ack, 6 }, { ack, 5 } };
+        const char* const runs_sent[] = { "ack 3 multiple", "reject 4",
+                                          "ack 6 multiple" };
+        run("runs split by a reject", runs, 6, runs_sent, 3);
+
+        const Step rejected_first[] = { { reject, 1 }, { ack, 2 } };
+        const char* const rejected_first_sent[] = { "reject 1", "ack 2" };
+        run("reject before any ack", rejected_first, 2, rejected_first_sent,
+            2);
+
+        const Step deferred[] = { { ack, 1 }, { defer_reject, 2 },
+                                  { defer_reject, 4 }, { ack, 3 }, { ack, 5 },
+                                  { ack, 6 } };
+        const char* const deferred_sent[] = { "reject 2", "ack 1", "reject 4",
+                                              "ack 3", "ack 6 multiple" };
+        run("deferred rejects", deferred, 6, deferred_sent, 5);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#include <iostream>
+#include <map>
+#include <amqp_consumer.hpp>
+#include "fake_broker.hpp"
+
+// Runs ConsumerRuntime against the fake broker with handlers that ack,
+// nack and reject in parallel, and checks that every delivery is settled
+// exactly once, the way its handler chose, without the broker refusing
+// any method.
+
+namespace
+{
+    const size_t messages = 3000;
+
+    char outcome(uint64_t delivery_tag)
+    {
+        switch(delivery_tag % 3)
+        {
+        case 0:
+            return 'r';
+        case 1:
+            return 'a';
+        default:
+            return 'n';
+        }
+    }
+
+    void handle(Delivery& delivery)
+    {
+        switch(outcome(delivery.delivery_tag()))
+        {
+        case 'r':
+            delivery.reject(false);
+            break;
+
+        case 'a':
+            delivery.ack();
+            break;
+
+        default:
+            delivery.nack(false);
+            break;
+        }
+    }
+}
+
+int main()
+{
+    std::map<uint64_t, char> settled;
+    std::vector<std::string> errors;
+    try
+    {
+        FakeBroker broker(messages);
+        {
+            AmqpConnection conn("127.0.0.1", broker.port());
+            AmqpChannel channel(conn);
+            AmqpEventLoop loop;
+
+            ConsumerRuntime runtime(loop, conn, 4, handle);
+            runtime.attach(channel, 32);
+            runtime.start();
+
+            const boost::chrono::steady_clock::time_point deadline =
+                    boost::chrono::steady_clock::now() +
+                    boost::chrono::seconds(10);
+            while(broker.unacked() > 0 &&
+                  boost::chrono::steady_clock::now() < deadline)
+                loop.run_once(10);
+        }
+        broker.join();
+
+        settled = broker.settled();
+        errors = broker.errors();
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+    for(size_t i = 0; i < errors.size(); ++i, ++failures)
+        std::cerr << "broker: " << errors[i] << std::endl;
+
+    if(settled.size() != messages)
+    {
+        ++failures;
+        std::cerr << "settled " << settled.size() << " of " << messages
+                  << std::endl;
+    }
+
+    for(std::map<uint64_t, char>::const_iterator it = settled.begin();
+        it != settled.end(); ++it)
+    {
+        if(it->second != outcome(it->first))
+        {
+            ++failures;
+            std::cerr << "tag " << it->first << " settled as " << it->second
+                      << ", expected " << outcome(it->first) << std::endl;
+        }
+    }
+
+    if(failures == 0)
+        std::cout << "ok mixed outcomes over " << messages << " deliveries"
+                  << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <amqp_filter.hpp>
+#include "fake_broker.hpp"
+
+// Checks that DiscardBatch settles filtered deliveries of two channels of
+// one connection on the channel they came from, through the channel's own
+// AckAccumulator or with plain frames when the channel has none.
+
+namespace
+{
+    int failures = 0;
+
+    const uint64_t tags = 4;
+
+    struct Expected
+    {
+        amqp_channel_t channel;
+        const char* settled; // outcome of tags 1, 2, ...
+    };
+
+    void verify(const char* name, FakeBroker& broker,
+                const Expected* expected, size_t count)
+    {
+        std::vector<std::string> errors = broker.errors();
+        for(size_t i = 0; i < count; ++i)
+        {
+            const std::map<uint64_t, char> settled =
+                    broker.settled(expected[i].channel);
+            std::string outcomes;
+            for(uint64_t tag = 1; tag <= tags; ++tag)
+            {
+                std::map<uint64_t, char>::const_iterator it =
+                        settled.find(tag);
+                outcomes += it == settled.end() ? '-' : it->second;
+            }
+
+            if(outcomes != expected[i].settled)
+                errors.push_back("channel settled as " + outcomes +
+                                 ", expected " + expected[i].settled);
+        }
+
+        if(errors.empty() && broker.unacked() == 0)
+        {
+            std::cout << "ok " << name << std::endl;
+            return;
+        }
+
+        ++failures;
+        std::cerr << "FAIL " << name << std::endl;
+        for(size_t i = 0; i < errors.size(); ++i)
+            std::cerr << "  " << errors[i] << std::endl;
+        if(broker.unacked() != 0)
+            std::cerr << "  " << broker.unacked() << " tags unsettled"
+                      << std::endl;
+    }
+
+    void reject_with_accumulators()
+    {
+        FakeBroker broker(0, tags);
+        {
+            AmqpConnection conn("127.0.0.1", broker.port());
+            AmqpChannel first(conn, 1);
+            AmqpChannel second(conn, 2);
+            AckAccumulator first_acks(first, 1024);
+            AckAccumulator second_acks(second, 1024);
+
+            DiscardBatch batch(first, DiscardBatch::reject, &first_acks);
+            batch.accumulator(second_acks);
+
+            first_acks.complete(1);
+            batch(2, 1);
+            batch(1, 2);
+            second_acks.complete(2);
+            batch(2, 3);
+            first_acks.complete(3);
+            second_acks.complete(4);
+            batch(1, 4);
+            batch.flush();
+        }
+        broker.join();
+
+        const Expected expected[] = { { 1, "arar" }, { 2, "rara" } };
+        verify("rejects through each channel's accumulator", broker,
+               expected, 2);
+    }
+
+    void ack_without_accumulator()
+    {
+        FakeBroker broker(0, tags);
+        {
+            AmqpConnection conn("127.0.0.1", broker.port());
+            AmqpChannel first(conn, 1);
+            AmqpChannel second(conn, 2);
+            AckAccumulator first_acks(first, 1024);
+
+            DiscardBatch batch(first, DiscardBatch::ack, &first_acks);
+            for(uint64_t tag = 1; tag <= tags; ++tag)
+            {
+                batch(1, tag);
+                batch(2, tag);
+            }
+            batch.flush();
+        }
+        broker.join();
+
+        const Expected expected[] = { { 1, "aaaa" }, { 2, "aaaa" } };
+        verify("acks on a channel without an accumulator", broker,
+               expected, 2);
+    }
+}
+
+int main()
+{
+    try
+    {
+        reject_with_accumulators();
+        ack_without_accumulator();
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
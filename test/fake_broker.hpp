@@ -0,0 +1,407 @@
+#ifndef FAKE_BROKER_HPP
+#define FAKE_BROKER_HPP
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <amqp_encoder.hpp>
+
+// An in-process broker on a loopback socket for the tests and the
+// benchmark. It logs in one client and opens channels. On each new channel
+// it either delivers a run of messages or calls an OpenHandler, which
+// writes its own frames with send(). Acks, nacks and rejects are settled
+// against the set of unacknowledged tags the way RabbitMQ does: a method
+// naming a tag that is not outstanding on its channel is a
+// PRECONDITION_FAILED error. Tags are numbered per channel, from 1.
+// Anything else, such as publishes, is read and only counted.
+class FakeBroker: boost::noncopyable
+{
+public:
+    // Runs on the broker thread after channel.open-ok.
+    typedef boost::function<void (FakeBroker&, amqp_channel_t)> OpenHandler;
+
+    // outstanding tags of each new channel count as delivered without
+    // anything being sent; deliveries follow them.
+    explicit FakeBroker(size_t deliveries = 0, uint64_t outstanding = 0):
+        deliveries_(deliveries),
+        outstanding_(outstanding),
+        listen_fd_(socket(AF_INET, SOCK_STREAM, 0)),
+        fd_(-1),
+        decoded_(),
+        received_bytes_()
+    {
+        start();
+    }
+
+    explicit FakeBroker(const OpenHandler& on_open):
+        deliveries_(),
+        outstanding_(),
+        on_open_(on_open),
+        listen_fd_(socket(AF_INET, SOCK_STREAM, 0)),
+        fd_(-1),
+        decoded_(),
+        received_bytes_()
+    {
+        start();
+    }
+
+    int port() const
+    {
+        return port_;
+    }
+
+    // Writes to the client; for OpenHandlers.
+    void send(const char* data, size_t size)
+    {
+        while(size > 0)
+        {
+            const ssize_t rc = ::send(fd_, data, size, MSG_NOSIGNAL);
+            check_os("fake broker: sending", rc);
+            data += rc;
+            size -= rc;
+        }
+    }
+
+    // Bytes of every frame the client sent; read it after join().
+    uint64_t received_bytes() const
+    {
+        return received_bytes_;
+    }
+
+    // "ack 3", "ack 5 multiple", "reject 2", "nack 4" in arrival order.
+    std::vector<std::string> settlements(amqp_channel_t channel = 1)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return channels_[channel].settlements;
+    }
+
+    std::vector<std::string> errors()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return errors_;
+    }
+
+    // Settled tags and how: 'a' ack, 'n' nack, 'r' reject.
+    std::map<uint64_t, char> settled(amqp_channel_t channel = 1)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return channels_[channel].settled;
+    }
+
+    // Outstanding tags over all channels.
+    size_t unacked()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        size_t count = 0;
+        for(Channels::const_iterator it = channels_.begin();
+            it != channels_.end(); ++it)
+            count += it->second.unacked.size();
+        return count;
+    }
+
+    void join()
+    {
+        thread_.join();
+    }
+
+    ~FakeBroker()
+    {
+        thread_.join();
+        if(fd_ >= 0)
+            close(fd_);
+        close(listen_fd_);
+        empty_amqp_pool(&pool_);
+    }
+
+private:
+    struct Tags
+    {
+        std::set<uint64_t> unacked;
+        std::map<uint64_t, char> settled;
+        std::vector<std::string> settlements;
+    };
+
+    typedef std::map<amqp_channel_t, Tags> Channels;
+
+    void start()
+    {
+        check_os("fake broker: socket", listen_fd_);
+
+        sockaddr_in addr = sockaddr_in();
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof addr;
+        sockaddr* address = reinterpret_cast<sockaddr*>(&addr);
+
+        check_os("fake broker: bind", bind(listen_fd_, address, len));
+        check_os("fake broker: listen", listen(listen_fd_, 1));
+        check_os("fake broker: getsockname",
+                 getsockname(listen_fd_, address, &len));
+        port_ = ntohs(addr.sin_port);
+
+        init_amqp_pool(&pool_, 4096);
+        thread_ = boost::thread(boost::bind(&FakeBroker::serve, this));
+    }
+
+    void read_full(char* out, size_t size)
+    {
+        while(size > 0)
+        {
+            const ssize_t rc = recv(fd_, out, size, 0);
+            if(rc <= 0)
+                throw std::runtime_error("fake broker: connection lost");
+            out += rc;
+            size -= rc;
+        }
+    }
+
+    void send_method(amqp_channel_t channel, amqp_method_number_t id,
+                     void* decoded)
+    {
+        FrameEncoder encoder;
+        encoder.method(channel, id, decoded);
+        send(encoder.data(), encoder.size());
+    }
+
+    // Reads one frame; returns its method id, or 0 for other frames. The
+    // decoded method is in decoded_ until the next call; publishes, which
+    // the benchmark sends by the million, are not decoded.
+    amqp_method_number_t read_frame(amqp_channel_t& channel)
+    {
+        char header[FrameEncoder::frame_header_size];
+        read_full(header, sizeof header);
+
+        uint16_t channel_id;
+        uint32_t size;
+        memcpy(&channel_id, header + 1, 2);
+        memcpy(&size, header + 3, 4);
+        channel = ntohs(channel_id);
+        size = ntohl(size);
+
+        payload_.resize(size + FrameEncoder::frame_footer_size);
+        read_full(&payload_[0], payload_.size());
+        received_bytes_ += sizeof header + payload_.size();
+
+        if(header[0] != AMQP_FRAME_METHOD || size < 4)
+            return 0;
+
+        uint32_t id;
+        memcpy(&id, &payload_[0], 4);
+        id = ntohl(id);
+        if(id == AMQP_BASIC_PUBLISH_METHOD)
+            return id;
+
+        amqp_bytes_t encoded;
+        encoded.bytes = &payload_[4];
+        encoded.len = size - 4;
+        recycle_amqp_pool(&pool_);
+        decoded_ = 0;
+        check("fake broker: decoding",
+              amqp_decode_method(id, &pool_, encoded, &decoded_));
+        return id;
+    }
+
+    void handshake()
+    {
+        char protocol_header[8];
+        read_full(protocol_header, sizeof protocol_header);
+
+        amqp_channel_t channel;
+        amqp_connection_start_t start;
+        start.version_major = AMQP_PROTOCOL_VERSION_MAJOR;
+        start.version_minor = AMQP_PROTOCOL_VERSION_MINOR;
+        start.server_properties = amqp_empty_table;
+        start.mechanisms = amqp_cstring_bytes("PLAIN");
+        start.locales = amqp_cstring_bytes("en_US");
+        send_method(0, AMQP_CONNECTION_START_METHOD, &start);
+        read_frame(channel); // start-ok
+
+        amqp_connection_tune_t tune;
+        tune.channel_max = 0;
+        tune.frame_max = 131072;
+        tune.heartbeat = 0;
+        send_method(0, AMQP_CONNECTION_TUNE_METHOD, &tune);
+        read_frame(channel); // tune-ok
+        read_frame(channel); // open
+
+        amqp_connection_open_ok_t open_ok;
+        open_ok.known_hosts = amqp_empty_bytes;
+        send_method(0, AMQP_CONNECTION_OPEN_OK_METHOD, &open_ok);
+    }
+
+    // Counted before open-ok goes out, so the client never sees the
+    // channel without its tags.
+    void open(amqp_channel_t channel)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        Tags& tags = channels_[channel];
+        for(uint64_t tag = 1; tag <= outstanding_ + deliveries_; ++tag)
+            tags.unacked.insert(tag);
+    }
+
+    void deliver(amqp_channel_t channel)
+    {
+        FrameEncoder encoder;
+        std::string body(32, 'x');
+        amqp_bytes_t body_bytes;
+        body_bytes.bytes = &body[0];
+        body_bytes.len = body.size();
+
+        amqp_basic_properties_t props = amqp_basic_properties_t();
+        for(size_t i = 0; i < deliveries_; ++i)
+        {
+            const uint64_t tag = outstanding_ + i + 1;
+
+            amqp_basic_deliver_t method;
+            method.consumer_tag = amqp_cstring_bytes("test");
+            method.delivery_tag = tag;
+            method.redelivered = 0;
+            method.exchange = amqp_empty_bytes;
+            method.routing_key = amqp_cstring_bytes("test");
+
+            encoder.method(channel, AMQP_BASIC_DELIVER_METHOD, &method);
+            encoder.header(channel, body.size(), props);
+            encoder.body(channel, body_bytes);
+        }
+        send(encoder.data(), encoder.size());
+    }
+
+    // Settles tag, and with multiple every outstanding tag below it.
+    void settle(amqp_channel_t channel, const char* name, char kind,
+                uint64_t tag, bool multiple)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        std::ostringstream event;
+        event << name << ' ' << tag << (multiple ? " multiple" : "");
+        Tags& tags = channels_[channel];
+        tags.settlements.push_back(event.str());
+
+        if(tags.unacked.count(tag) == 0)
+        {
+            std::ostringstream error;
+            error << "PRECONDITION_FAILED - unknown delivery tag: "
+                  << event.str() << " on channel " << channel;
+            errors_.push_back(error.str());
+            return;
+        }
+
+        std::set<uint64_t>::iterator end = tags.unacked.upper_bound(tag);
+        std::set<uint64_t>::iterator begin =
+                multiple ? tags.unacked.begin() : tags.unacked.find(tag);
+        for(std::set<uint64_t>::iterator it = begin; it != end; ++it)
+        {
+            if(!tags.settled.insert(std::make_pair(*it, kind)).second)
+                errors_.push_back("settled twice: " + event.str());
+        }
+        tags.unacked.erase(begin, end);
+    }
+
+    void serve()
+    {
+        try
+        {
+            fd_ = accept(listen_fd_, 0, 0);
+            check_os("fake broker: accept", fd_);
+            handshake();
+
+            while(true)
+            {
+                amqp_channel_t channel;
+                const amqp_method_number_t id = read_frame(channel);
+                switch(id)
+                {
+                case AMQP_CHANNEL_OPEN_METHOD:
+                    {
+                        amqp_channel_open_ok_t ok;
+                        ok.channel_id = amqp_empty_bytes;
+                        open(channel);
+                        send_method(channel, AMQP_CHANNEL_OPEN_OK_METHOD, &ok);
+                        if(on_open_)
+                            on_open_(*this, channel);
+                        else if(deliveries_ > 0)
+                            deliver(channel);
+                    }
+                    break;
+
+                case AMQP_BASIC_ACK_METHOD:
+                    {
+                        const amqp_basic_ack_t* ack =
+                                static_cast<amqp_basic_ack_t*>(decoded_);
+                        settle(channel, "ack", 'a', ack->delivery_tag,
+                               ack->multiple);
+                    }
+                    break;
+
+                case AMQP_BASIC_NACK_METHOD:
+                    {
+                        const amqp_basic_nack_t* nack =
+                                static_cast<amqp_basic_nack_t*>(decoded_);
+                        settle(channel, "nack", 'n', nack->delivery_tag,
+                               nack->multiple);
+                    }
+                    break;
+
+                case AMQP_BASIC_REJECT_METHOD:
+                    {
+                        const amqp_basic_reject_t* reject =
+                                static_cast<amqp_basic_reject_t*>(decoded_);
+                        settle(channel, "reject", 'r', reject->delivery_tag,
+                               false);
+                    }
+                    break;
+
+                case AMQP_CHANNEL_CLOSE_METHOD:
+                    {
+                        amqp_channel_close_ok_t ok;
+                        send_method(channel, AMQP_CHANNEL_CLOSE_OK_METHOD, &ok);
+                    }
+                    break;
+
+                case AMQP_CONNECTION_CLOSE_METHOD:
+                    {
+                        amqp_connection_close_ok_t ok;
+                        send_method(0, AMQP_CONNECTION_CLOSE_OK_METHOD, &ok);
+                    }
+                    return;
+                }
+            }
+        }
+        catch(const std::exception& e)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            errors_.push_back(e.what());
+        }
+    }
+
+    const size_t deliveries_;
+    const uint64_t outstanding_;
+    const OpenHandler on_open_;
+    const int listen_fd_;
+    int fd_;
+    int port_;
+    amqp_pool_t pool_;
+    void* decoded_;
+    std::vector<char> payload_;
+    uint64_t received_bytes_;
+
+    boost::mutex mutex_;
+    Channels channels_;
+    std::vector<std::string> errors_;
+
+    boost::thread thread_;
+};
+
+#endif // FAKE_BROKER_HPP